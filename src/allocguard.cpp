@@ -0,0 +1,101 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdlib>
+#include <new>
+#include <unistd.h>
+#include "allocguard.h"
+
+// The number of NoAllocationScopes the current thread is in.
+static thread_local unsigned int scopeDepth = 0;
+
+NoAllocationScope::NoAllocationScope()
+{
+   scopeDepth++;
+}
+
+NoAllocationScope::~NoAllocationScope()
+{
+   scopeDepth--;
+}
+
+static void checkAllocation()
+{
+   if (scopeDepth)
+   {
+      // No stdio here, it might want to allocate.
+      static const char message[] =
+         "\nallocation check: heap allocation in the control loop, aborting\n";
+      if (write(2, message, sizeof(message) - 1)) {}
+      abort();
+   }
+}
+
+void* operator new(std::size_t size)
+{
+   checkAllocation();
+   void* p = std::malloc(size ? size : 1);
+   if (!p)
+      throw std::bad_alloc();
+   return p;
+}
+
+void* operator new[](std::size_t size)
+{
+   return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+   std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+   std::free(p);
+}
+
+#ifdef __GLIBC__
+// Catch the C allocation functions too, forwarding them to glibc's own.
+extern "C"
+{
+   void* __libc_malloc(size_t size);
+   void* __libc_calloc(size_t count, size_t size);
+   void* __libc_realloc(void* p, size_t size);
+
+   void* malloc(size_t size)
+   {
+      checkAllocation();
+      return __libc_malloc(size);
+   }
+
+   void* calloc(size_t count, size_t size)
+   {
+      checkAllocation();
+      return __libc_calloc(count, size);
+   }
+
+   void* realloc(void* p, size_t size)
+   {
+      checkAllocation();
+      return __libc_realloc(p, size);
+   }
+}
+#endif
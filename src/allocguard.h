@@ -0,0 +1,52 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ALLOCGUARD_H
+#define ALLOCGUARD_H
+
+/* Enforcement of an allocation-free control loop.
+ *
+ * Heap allocations cause jitter in the control loop, so the loop is written
+ * not to make any. In builds with ALLOCATION_CHECK defined, the global
+ * allocation functions (operator new and, with glibc, malloc and friends)
+ * are replaced by versions that abort the program when called from a thread
+ * that is within the lifetime of a NoAllocationScope object. In regular
+ * builds, NoAllocationScope does nothing.
+*/
+#ifdef ALLOCATION_CHECK
+
+class NoAllocationScope
+{
+public:
+   NoAllocationScope();
+   ~NoAllocationScope();
+};
+
+#else
+
+class NoAllocationScope
+{
+public:
+   NoAllocationScope() {}
+};
+
+#endif
+
+#endif // ALLOCGUARD_H
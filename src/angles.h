@@ -21,6 +21,9 @@
 #ifndef ANGLES_H
 #define ANGLES_H
 
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 
 /* Explanation: raw, cooked and user angles:
@@ -47,21 +50,45 @@ typedef float degrees;
 
 degrees mod360(degrees value);
 
-/* RawAngle is not a subclass of Angle (declared below) because it does not
- * represent a true angle due to the possible nonlinearities in the
- * measurement. No arithmetic, then: just values.
+
+/* Storage of angle values.
+ *
+ * DegreeStorage keeps angles as floating point degrees. BinaryStorage<N>
+ * keeps them as N-bit binary angles (BAM), where 2^N counts make one full
+ * turn: wrapping around 360 degrees is then just integer overflow (masked
+ * to N bits) and all arithmetic is exact. Differences between binary angles
+ * are taken along the shorter of the two paths around the circle.
 */
+struct DegreeStorage
+{
+   typedef degrees value_type;
 
-class RawAngle
+   inline static degrees toDegrees(value_type v) { return v; }
+   inline static value_type add(value_type v, degrees deg) { return v + deg; }
+   inline static degrees difference(value_type a, value_type b) { return a - b; }
+};
+
+template <unsigned int Bits>
+struct BinaryStorage
 {
-public:
-   explicit RawAngle(degrees value) : val(value) {}
-   degrees val;
+   typedef uint32_t value_type;
+   static const value_type mask = (value_type(1) << Bits) - 1;
 
-   // RawAngle arithmetic should ensure that the result never goes outside the
-   // range [0:360).
-   inline RawAngle operator+(const degrees& deg) const
-      { return RawAngle(mod360(val + deg)); }
+   inline static degrees toDegrees(value_type v)
+      { return v * (360.0f / (mask + 1)); }
+
+   inline static value_type fromDegrees(degrees deg)
+      { return (value_type)(int32_t)std::lround(deg * ((mask + 1) / 360.0f)) & mask; }
+
+   inline static value_type add(value_type v, degrees deg)
+      { return (v + fromDegrees(deg)) & mask; }
+
+   inline static degrees difference(value_type a, value_type b)
+   {
+      // Sign-extend the N-bit difference.
+      int32_t counts = (int32_t)(((a - b) & mask) << (32 - Bits)) >> (32 - Bits);
+      return counts * (360.0f / (mask + 1));
+   }
 };
 
 
@@ -73,12 +100,14 @@ public:
  * therefore throw a compile-time error.
 */
 
-template <class DerivedAngle>
+template <class DerivedAngle, class Storage = DegreeStorage>
 class Angle
 {
 public:
+   typedef typename Storage::value_type value_type;
+
    Angle() = default;
-   explicit Angle(degrees value) : val(value) {}
+   explicit Angle(value_type value) : val(value) {}
 
    // comparison operators
    inline bool operator>(const DerivedAngle& other) const { return val > other.val; }
@@ -87,12 +116,54 @@ public:
    inline bool operator<=(const DerivedAngle& other) const { return val <= other.val; }
 
    // difference between two angles in degrees
-   inline degrees operator-(const DerivedAngle& other) const { return val - other.val; }
+   inline degrees operator-(const DerivedAngle& other) const
+      { return Storage::difference(val, other.val); }
+
+   inline DerivedAngle operator+(const degrees& deg) const
+      { return DerivedAngle(Storage::add(val, deg)); }
+   inline DerivedAngle operator-(const degrees& deg) const
+      { return DerivedAngle(Storage::add(val, -deg)); }
+
+   inline degrees toDegrees() const { return Storage::toDegrees(val); }
+
+   value_type val;
+};
+
+
+/* A readout of the AS5048A encoder: a 14-bit binary angle. This is what the
+ * hardware delivers, so the sensors hand these out without any floating
+ * point conversions and the conversion to cooked angles can be done by
+ * a table lookup.
+*/
+class RawCode : public Angle<RawCode, BinaryStorage<14> >
+{
+public:
+   explicit RawCode(value_type code) : Angle(code & mask) {}
 
-   inline DerivedAngle operator+(const degrees& deg) const { return DerivedAngle(val + deg); }
-   inline DerivedAngle operator-(const degrees& deg) const { return DerivedAngle(val - deg); }
+   inline static RawCode fromDegrees(degrees deg)
+      { return RawCode(BinaryStorage<14>::fromDegrees(deg)); }
 
+   static const unsigned int bits = 14;
+   static const value_type mask = BinaryStorage<14>::mask;
+};
+
+
+/* RawAngle is not a subclass of Angle (declared above) because it does not
+ * represent a true angle due to the possible nonlinearities in the
+ * measurement. No arithmetic, then: just values.
+*/
+
+class RawAngle
+{
+public:
+   explicit RawAngle(degrees value) : val(value) {}
+   explicit RawAngle(const RawCode code) : val(code.toDegrees()) {}
    degrees val;
+
+   // RawAngle arithmetic should ensure that the result never goes outside the
+   // range [0:360).
+   inline RawAngle operator+(const degrees& deg) const
+      { return RawAngle(mod360(val + deg)); }
 };
 
 
@@ -101,6 +172,7 @@ class CookedAngle : public Angle<CookedAngle>
 public:
    explicit CookedAngle(degrees value) : Angle(value) {};
    explicit CookedAngle(const RawAngle raw);
+   explicit CookedAngle(const RawCode code) : Angle(codeTable()[code.val]) {}
    explicit CookedAngle(const UserAngle user);
 
    /* Angle linearization.
@@ -115,6 +187,18 @@ public:
    */
    static void setLinearization(const std::vector<float>& coefficients);
 
+   /* Batch conversions, meant for processing large data sets (telemetry,
+    * calibration data etc.) offline. They are vectorized and large inputs
+    * are split among several threads. The results agree with the ones
+    * obtained by converting the angles one by one to within batchTolerance,
+    * provided that the linearization corrections stay below 180 degrees.
+    * Codes are converted by the same table as CookedAngle(RawCode) and the
+    * results are identical.
+   */
+   static void fromRaw(const RawAngle* raw, CookedAngle* cooked, std::size_t count);
+   static void fromCodes(const uint16_t* codes, CookedAngle* cooked, std::size_t count);
+   static const degrees batchTolerance;
+
    // Set the origin of the cooked angle scale. This must be set somewhere
    // within the range of raw values that will never be reached due to hardware
    // restrictions.
@@ -135,12 +219,29 @@ public:
 private:
    static degrees linearize(degrees val);
 
+   // Cooked angles for all possible raw codes, rebuilt by the setters
+   // whenever any of the conversion parameters changes (so that the
+   // conversions never write anything and never allocate).
+   inline static const degrees* codeTable() { return codeTableData; }
+   static void buildCodeTable();
+
+   // The common part of all batch conversions.
+   template <class Load, class Store>
+   static void convertBatch(Load load, Store store, std::size_t count,
+                            degrees shift);
+
    static std::vector<float> linCoeffs;
+   static degrees codeTableData[RawCode::mask + 1];
+   static const bool initialCodeTable;
    static RawAngle hardwareOrigin;
    static degrees offset;
    static bool inverted;
    static CookedAngle minimumSafeAngle;
    static CookedAngle maximumSafeAngle;
+
+   // allow UserAngle to use the batch conversion
+   friend class UserAngle;
+   friend struct AngleScales;
 };
 
 
@@ -154,6 +255,10 @@ public:
    // will read zero.
    static void setOrigin(const CookedAngle origin);
 
+   // Batch conversions (see CookedAngle for details).
+   static void fromRaw(const RawAngle* raw, UserAngle* user, std::size_t count);
+   static void fromCodes(const uint16_t* codes, UserAngle* user, std::size_t count);
+
    // Check whether this angle is within the safe slew zone.
    bool isSafe() const;
 
@@ -162,6 +267,27 @@ private:
 
    // allow CookedAngle to access userOrigin
    friend class CookedAngle;
+   friend struct AngleScales;
+};
+
+
+/* The parameters of the cooked and user angle scales together, so that a
+ * complete set of them can be taken aside and put in effect at once.
+*/
+struct AngleScales
+{
+   std::vector<float> linearization;
+   RawAngle origin = RawAngle(0);
+   bool inverted = false;
+   CookedAngle minimum = CookedAngle(0);
+   CookedAngle maximum = CookedAngle(360);
+   CookedAngle userOrigin = CookedAngle(0);
+
+   // The scales in effect.
+   static AngleScales current();
+
+   // Put these scales in effect.
+   void apply() const;
 };
 
 #endif // ANGLES_H
@@ -0,0 +1,395 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include <tclap/CmdLine.h>
+#include "controller.h"
+#include "indicator.h"
+
+/* Benchmarks of the controller hot path.
+ *
+ * The same backend objects are driven once through the statically
+ * dispatched controller (the one mcontrol uses) and once through the
+ * abstract interfaces, to show what the virtual calls cost. With hardware
+ * support enabled, the sensor is really read out, but the motor is only
+ * ever given a zero duty cycle.
+ *
+ * Besides that, the angle conversions are measured at several orders of the
+ * linearization, and a few short slews against a stub motor and sensor
+ * (which answer right away) give the cost of the control loop stages. The
+ * simulator build also times direction reversals through the H-bridge
+ * sequencer against the simulated relays.
+ *
+ * Every run first checks the batch angle conversions against the single
+ * ones at the same orders of the linearization and fails if they disagree.
+ * With --check, that is all it does (ctest runs it so).
+ *
+ * Every benchmark reports the mean time per call (the throughput) and the
+ * median and the 99th percentile of the time per call over batches of
+ * calls (the latency). With --json, the results come out as JSON lines
+ * instead of a table, for comparing builds by script.
+*/
+
+// Results are accumulated here so that the compiler can't optimize the
+// benchmarked calls away.
+volatile float sink;
+
+// Nanoseconds per call.
+struct Timing
+{
+   uint64_t calls;
+   double mean;
+   double median;
+   double p99;
+};
+
+Timing fromHistogram(const LatencyHistogram& histogram, unsigned int callsPerSample = 1)
+{
+   return Timing{histogram.count() * callsPerSample,
+                 histogram.mean() / callsPerSample,
+                 (double)histogram.percentile(0.5).count() / callsPerSample,
+                 (double)histogram.percentile(0.99).count() / callsPerSample};
+}
+
+// Time iterations calls to f(), in batches of batchSize calls.
+template <class Function>
+Timing measure(Function f, unsigned int iterations, unsigned int batchSize = 100)
+{
+   LatencyHistogram batches;
+   for (unsigned int done = 0; done < iterations; done += batchSize)
+   {
+      auto start = std::chrono::steady_clock::now();
+      for (unsigned int i = 0; i < batchSize; i++)
+         f();
+      batches.record(std::chrono::steady_clock::now() - start);
+   }
+   return fromHistogram(batches, batchSize);
+}
+
+
+class Report
+{
+public:
+   Report(bool json_) : json(json_)
+   {
+      if (!json)
+         printf("%-40s %-8s %10s %10s %10s\n", "operation [ns/call]", "variant",
+                "mean", "median", "p99");
+   }
+
+   void add(const char* name, const char* variant, const Timing& timing)
+   {
+      if (json)
+         printf("{\"benchmark\":\"%s\",\"variant\":\"%s\",\"calls\":%llu,"
+                "\"mean_ns\":%.1f,\"median_ns\":%.1f,\"p99_ns\":%.1f}\n",
+                name, variant, (unsigned long long)timing.calls, timing.mean,
+                timing.median, timing.p99);
+      else
+         printf("%-40s %-8s %10.1f %10.1f %10.1f\n", name, variant,
+                timing.mean, timing.median, timing.p99);
+   }
+
+private:
+   bool json;
+};
+
+
+/* A motor and a sensor that answer right away: every readout moves the axis
+ * by an amount proportional to the duty cycle.
+*/
+class StubMotor final : public Motor
+{
+public:
+   void turnOff() { direction = 0; }
+   void setPWM(float duty_) { duty = duty_; }
+
+   degrees angle = 100;
+   int direction = 0;
+   float duty = 0;
+
+protected:
+   void turnOnDir1() { direction = 1; }
+   void turnOnDir2() { direction = -1; }
+};
+
+class StubSensor final : public Sensor
+{
+public:
+   StubSensor(StubMotor& motor_) : motor(motor_) {}
+
+   RawAngle getRawAngle()
+   {
+      motor.angle += motor.direction * motor.duty * 0.0002;
+      return RawAngle(mod360(motor.angle));
+   }
+
+private:
+   StubMotor& motor;
+};
+
+
+/* Checks the batch conversions against the ones of single angles, with the
+ * current linearization, over all the codes and the raw angles halfway
+ * between them. Returns false (reporting the worst disagreement) if the
+ * raw angles disagree by more than batchTolerance or the codes at all.
+*/
+static bool checkBatchConversions(const char* variant)
+{
+   const unsigned int numberOfCodes = 1 << RawCode::bits;
+   std::vector<uint16_t> codes(numberOfCodes);
+   std::vector<RawAngle> raws(2 * numberOfCodes, RawAngle(0));
+   for (unsigned int i = 0; i < numberOfCodes; i++)
+      codes[i] = i;
+   for (unsigned int i = 0; i < raws.size(); i++)
+      raws[i] = RawAngle(360.0 * i / raws.size());
+
+   std::vector<CookedAngle> cooked(raws.size(), CookedAngle(0));
+   std::vector<UserAngle> user(raws.size(), UserAngle(0));
+   degrees worst = 0;
+   RawAngle worstRaw(0);
+   CookedAngle::fromRaw(raws.data(), cooked.data(), raws.size());
+   UserAngle::fromRaw(raws.data(), user.data(), raws.size());
+   for (unsigned int i = 0; i < raws.size(); i++)
+   {
+      degrees difference = std::max(
+         std::abs(cooked[i].val - CookedAngle(raws[i]).val),
+         std::abs(user[i].val - UserAngle(CookedAngle(raws[i])).val));
+      if (difference > worst)
+      {
+         worst = difference;
+         worstRaw = raws[i];
+      }
+   }
+
+   unsigned int codeMismatches = 0;
+   CookedAngle::fromCodes(codes.data(), cooked.data(), numberOfCodes);
+   UserAngle::fromCodes(codes.data(), user.data(), numberOfCodes);
+   for (unsigned int i = 0; i < numberOfCodes; i++)
+   {
+      CookedAngle single(RawCode(codes[i]));
+      if (cooked[i].val != single.val || user[i].val != UserAngle(single).val)
+         codeMismatches++;
+   }
+
+   if (worst <= CookedAngle::batchTolerance && !codeMismatches)
+      return true;
+   fprintf(stderr, "batch conversions (%s): off by up to %g degrees "
+           "(at raw angle %g), %u codes differ\n",
+           variant, worst, worstRaw.val, codeMismatches);
+   return false;
+}
+
+
+// The linearization coefficients of the given order used by the benchmarks.
+static std::vector<float> linearization(unsigned int order)
+{
+   std::vector<float> coefficients(2 * order);
+   for (unsigned int i = 0; i < coefficients.size(); i++)
+      coefficients[i] = 0.1 / (i + 1);
+   return coefficients;
+}
+
+
+static const unsigned int orders[] = { 0, 1, 2, 4, 8, 16 };
+
+
+/* Checks the batch conversions at all the orders of the benchmarks, and
+ * with the cooked scale turned around and moved. Leaves the default angle
+ * scales behind.
+*/
+static bool checkAllBatchConversions()
+{
+   bool agree = true;
+   for (unsigned int order : orders)
+   {
+      CookedAngle::setLinearization(linearization(order));
+      char variant[16];
+      snprintf(variant, sizeof(variant), "order %u", order);
+      agree &= checkBatchConversions(variant);
+   }
+
+   CookedAngle::setOrigin(RawAngle(123.4));
+   CookedAngle::setInverted(true);
+   UserAngle::setOrigin(CookedAngle(56.7));
+   agree &= checkBatchConversions("order 16, inverted");
+   CookedAngle::setOrigin(RawAngle(0));
+   CookedAngle::setInverted(false);
+   UserAngle::setOrigin(CookedAngle(0));
+   CookedAngle::setLinearization(std::vector<float>());
+   return agree;
+}
+
+
+int main(int argc, char* argv[])
+{
+   bool json, checkOnly;
+   try
+   {
+      TCLAP::CmdLine cmd("Controller benchmarks");
+      TCLAP::SwitchArg arg_json("", "json", "Print the results as JSON lines", cmd);
+      TCLAP::SwitchArg arg_check("", "check",
+         "Only check the batch angle conversions", cmd);
+      cmd.parse(argc, argv);
+      json = arg_json.getValue();
+      checkOnly = arg_check.getValue();
+   }
+   catch (TCLAP::ArgException& e)
+   {
+      fprintf(stderr, "error: %s for arg %s\n", e.error().c_str(), e.argId().c_str());
+      return 1;
+   }
+
+   bool batchesAgree = checkAllBatchConversions();
+   if (checkOnly)
+      return batchesAgree ? 0 : 1;
+
+   const unsigned int iterations = 100000;
+   Report report(json);
+
+   ControllerParams params;
+   ControllerBackend backend;
+   BasicController<BackendMotor, BackendSensor> staticController(
+      params, backend.motor, backend.sensor);
+   BasicController<Motor, Sensor> virtualController(
+      params, backend.motor, backend.sensor);
+   Motor& motor = backend.motor;
+   Sensor& sensor = backend.sensor;
+
+   report.add("Sensor::getRawCode", "static",
+      measure([&] { sink = backend.sensor.getRawCode().val; }, iterations));
+   report.add("Sensor::getRawCode", "virtual",
+      measure([&] { sink = sensor.getRawCode().val; }, iterations));
+   report.add("Motor::setPWM", "static",
+      measure([&] { backend.motor.setPWM(0); }, iterations));
+   report.add("Motor::setPWM", "virtual",
+      measure([&] { motor.setPWM(0); }, iterations));
+   report.add("Controller::getCookedAngle", "static",
+      measure([&] { sink = staticController.getCookedAngle().val; }, iterations, 10));
+   report.add("Controller::getCookedAngle", "virtual",
+      measure([&] { sink = virtualController.getCookedAngle().val; }, iterations, 10));
+
+   // Angle conversions, over the whole circle.
+   const unsigned int numberOfAngles = 4096;
+   std::vector<degrees> angles(numberOfAngles);
+   for (unsigned int i = 0; i < numberOfAngles; i++)
+      angles[i] = -720 + 1440.0 * i / numberOfAngles;
+   unsigned int next = 0;
+   auto angle = [&] { return angles[next++ % numberOfAngles]; };
+
+   report.add("mod360", "",
+      measure([&] { sink = mod360(angle()); }, 10 * iterations));
+   report.add("RawCode -> CookedAngle -> UserAngle", "",
+      measure([&] { sink = UserAngle(CookedAngle(
+         RawCode((RawCode::value_type)(next++ * 7)))).val; }, 10 * iterations));
+
+   for (unsigned int order : orders)
+   {
+      CookedAngle::setLinearization(linearization(order));
+
+      char variant[16];
+      snprintf(variant, sizeof(variant), "order %u", order);
+      report.add("RawAngle -> CookedAngle", variant,
+         measure([&] { sink = CookedAngle(RawAngle(angle())).val; }, iterations));
+      report.add("RawAngle -> CookedAngle -> UserAngle", variant,
+         measure([&] { sink = UserAngle(CookedAngle(RawAngle(angle()))).val; },
+                 iterations));
+   }
+   CookedAngle::setLinearization(std::vector<float>());
+
+   // Progress output (formatting only, as the output is never started).
+   BarIndicator bar(CookedAngle(0), CookedAngle(90));
+   PercentIndicator percent(CookedAngle(0), CookedAngle(90));
+   report.add("BarIndicator::print", "",
+      measure([&] { bar.print(CookedAngle(mod360(angle())), true); }, iterations));
+   report.add("PercentIndicator::print", "",
+      measure([&] { percent.print(CookedAngle(mod360(angle())), true); }, iterations));
+
+   // Slew estimates, as a scheduler makes them for its candidate targets.
+   ControllerParams estimateParams;
+   estimateParams.model.points = {{20, 1, 0.2}, {100, 10, 0.2}};
+   SlewEstimator estimator;
+   estimator.configure(estimateParams);
+   SlewEstimate estimate;
+   report.add("SlewEstimator::estimate", "",
+      measure([&] { estimator.estimate(angle(), estimate);
+                    sink = estimate.duration; }, iterations));
+
+   // The slews below start the output; don't let them print the last record.
+   asyncOutput().progress(stdout, "%s", "");
+
+   // The stages of the control loop, over a few short slews back and forth.
+   StubMotor stubMotor;
+   StubSensor stubSensor(stubMotor);
+   ControllerParams stubParams;
+   stubParams.indicatorStyle = ControllerParams::IndicatorStyle::None;
+   BasicController<Motor, Sensor> stubController(stubParams, stubMotor, stubSensor);
+   SlewStatistics statistics;
+   stubController.setSignalHandling(false);
+   stubController.setStatistics(&statistics);
+   for (int i = 0; i < 4; i++)
+      stubController.slew(CookedAngle(i % 2 ? 100 : 102));
+   report.add("slew: sensor readout", "virtual", fromHistogram(statistics.sensorReadout));
+   report.add("slew: cooked angle", "virtual", fromHistogram(statistics.cookedAngle));
+   report.add("slew: duty computation", "virtual", fromHistogram(statistics.dutyComputation));
+   report.add("slew: setPWM", "virtual", fromHistogram(statistics.setPWM));
+   report.add("slew: progress", "virtual", fromHistogram(statistics.progress));
+
+#ifndef HARDWARE
+   // Reverse a few times at a moderate duty, measuring how long until the
+   // motor is connected the other way and until the PWM may be turned on.
+   // The (never armed) watchdog only provides the hardware mutex.
+   Watchdog watchdog(backend.motor, backend.sensor, params.watchdog);
+   BridgeSequencer<BackendMotor> bridge(backend.motor, params.bridge);
+   bridge.setWatchdog(&watchdog);
+   LatencyHistogram connected, ready;
+   bridge.engage(1);
+   for (int i = 0; i < 10; i++)
+   {
+      bridge.setDuty(20, 20);
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      int wanted = -bridge.direction();
+      auto start = std::chrono::steady_clock::now();
+      std::thread watcher([&] {
+         while (true)
+         {
+            {
+               std::lock_guard<PriorityInheritanceMutex> lock(watchdog.hardwareMutex());
+               if (backend.motor.contactDirection() == wanted)
+                  break;
+            }
+            std::this_thread::yield();
+         }
+         connected.record(std::chrono::steady_clock::now() - start);
+      });
+      bridge.reverse();
+      ready.record(std::chrono::steady_clock::now() - start);
+      watcher.join();
+   }
+   bridge.release();
+
+   report.add("reversal: motor connected", "", fromHistogram(connected));
+   report.add("reversal: PWM allowed", "", fromHistogram(ready));
+#endif
+
+   return batchesAgree ? 0 : 1;
+}
@@ -0,0 +1,154 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BRIDGE_H
+#define BRIDGE_H
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include "watchdog.h"
+
+struct BridgeTiming
+{
+   // after the relays open, before the other one may close
+   std::chrono::milliseconds releaseTime{10};
+   // after a relay closes, before the PWM may be turned on
+   std::chrono::milliseconds settleTime{15};
+   // the duty cycle is ramped up from the minimum duty over this long
+   std::chrono::milliseconds rampTime{50};
+};
+
+
+/* The H-bridge sequencer.
+ *
+ * The relays of the H-bridge must never switch while current flows through
+ * them, and one of them must be fully open before the other one closes. The
+ * sequencer wraps the motor commands so that every change of direction goes
+ * as: PWM off, relays open, releaseTime of dead time, the relay for the new
+ * direction closes, settleTime for its contacts to stop bouncing, and only
+ * then the PWM comes back, ramping up over rampTime. engage() and reverse()
+ * block for the dead times (without holding the hardware mutex); the
+ * release time is counted from the moment the relays opened, so a direction
+ * change that comes late enough does not wait at all.
+ *
+ * Once the watchdog has tripped, the motor can only be turned off. All
+ * hardware accesses are made with the hardware mutex of the watchdog held.
+*/
+template <class MotorType>
+class BridgeSequencer
+{
+public:
+   typedef std::chrono::steady_clock Clock;
+
+   BridgeSequencer(MotorType& motor_, const BridgeTiming& timing_) :
+      motor(motor_), timing(timing_) {}
+
+   inline void setTiming(const BridgeTiming& timing_) { timing = timing_; }
+   inline void setWatchdog(Watchdog* watchdog_) { watchdog = watchdog_; }
+
+   // Close the relay for the given direction (unless it is closed already)
+   // and wait until the PWM can be turned on. Returns false if the watchdog
+   // has tripped.
+   bool engage(float direction)
+   {
+      int wanted = (direction > 0 ? 1 : -1);
+      if (wanted == current)
+         return !tripped();
+      if (current)
+         release();
+
+      std::this_thread::sleep_until(releasedAt + timing.releaseTime);
+      {
+         auto lock = lockHardware();
+         if (tripped())
+            return false;
+         if (wanted > 0)
+            motor.turnOnDirPositive();
+         else
+            motor.turnOnDirNegative();
+         current = wanted;
+         closedAt = Clock::now();
+      }
+      std::this_thread::sleep_until(closedAt + timing.settleTime);
+      return true;
+   }
+
+   // Turn the other way, in the shortest time that the relays allow. The
+   // duty cycle starts from the minimum again.
+   inline bool reverse() { return engage(-current); }
+
+   // Set the duty cycle, limited by the ramp after a relay has closed. The
+   // ramp starts from minDuty (the lowest duty that keeps the axis moving),
+   // as anything below that would only stall the motor. With the relays
+   // open, the PWM stays off.
+   void setDuty(float duty, float minDuty = 0)
+   {
+      if (!current)
+         duty = 0;
+      else if (timing.rampTime.count() > 0 && duty > minDuty)
+      {
+         auto ramping = Clock::now() - (closedAt + timing.settleTime);
+         if (ramping < timing.rampTime)
+            duty = minDuty + (duty - minDuty) * std::max<float>(0,
+               (float)ramping.count() /
+               std::chrono::duration_cast<Clock::duration>(timing.rampTime).count());
+      }
+
+      auto lock = lockHardware();
+      if (!tripped())
+         motor.setPWM(duty);
+   }
+
+   // Turn the PWM off and open the relays.
+   void release()
+   {
+      auto lock = lockHardware();
+      motor.setPWM(0);
+      motor.turnOff();
+      if (current)
+         releasedAt = Clock::now();
+      current = 0;
+   }
+
+   // 1 or -1 while a relay is closed, 0 otherwise.
+   inline int direction() const { return current; }
+
+private:
+   inline bool tripped() const { return watchdog && watchdog->tripped(); }
+
+   std::unique_lock<PriorityInheritanceMutex> lockHardware() const
+   {
+      if (watchdog)
+         return std::unique_lock<PriorityInheritanceMutex>(watchdog->hardwareMutex());
+      return std::unique_lock<PriorityInheritanceMutex>();
+   }
+
+   MotorType& motor;
+   BridgeTiming timing;
+   Watchdog* watchdog = nullptr;
+
+   int current = 0;
+   Clock::time_point releasedAt;
+   Clock::time_point closedAt;
+};
+
+#endif // BRIDGE_H
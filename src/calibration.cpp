@@ -0,0 +1,219 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include "calibration.h"
+
+HarmonicFit::HarmonicFit(unsigned int order_) :
+   order(order_),
+   size(2 * order_ + 1),
+   normalMatrix(size * size, 0.0),
+   normalVector(size, 0.0),
+   phi(size, 0.0),
+   solution(size, 0.0),
+   coeffs(2 * order_, 0.0)
+{}
+
+
+void HarmonicFit::basis(degrees raw, double* phi) const
+{
+   double rad = raw * M_PI / 180.0;
+   double c1 = cos(rad);
+   double s1 = sin(rad);
+
+   // Higher harmonics are obtained by the angle addition formulas, which is
+   // a lot cheaper than calling cos() and sin() for every one of them.
+   double c = 1.0, s = 0.0;
+   phi[0] = 1.0;
+   for (unsigned int n = 0; n < order; n++)
+   {
+      double cn = c * c1 - s * s1;
+      s = s * c1 + c * s1;
+      c = cn;
+      phi[2*n + 1] = c;
+      phi[2*n + 2] = s;
+   }
+}
+
+
+degrees HarmonicFit::deviation(RawAngle raw, degrees reference) const
+{
+   // The reference scale can have an arbitrary origin, so the difference can
+   // lay anywhere on the circle. Unwrap it with respect to the first sample
+   // so that the deviations never jump by 360 degrees.
+   degrees diff = raw.val - reference - firstDeviation;
+   return firstDeviation + mod360(diff + 180.0) - 180.0;
+}
+
+
+void HarmonicFit::addSample(RawAngle raw, degrees reference)
+{
+   if (count == 0)
+      firstDeviation = mod360(raw.val - reference + 180.0) - 180.0;
+
+   double d = deviation(raw, reference);
+   basis(raw.val, phi.data());
+
+   // Only the upper triangle of the (symmetric) normal matrix is accumulated.
+   for (unsigned int i = 0; i < size; i++)
+   {
+      for (unsigned int j = i; j < size; j++)
+         normalMatrix[i*size + j] += phi[i] * phi[j];
+      normalVector[i] += phi[i] * d;
+   }
+   sumSquares += d * d;
+   count++;
+}
+
+
+bool HarmonicFit::solve()
+{
+   if (count < size)
+      return false;
+
+   // Cholesky decomposition, A = L * L^T, with L stored in the lower
+   // triangle of a copy of the normal matrix.
+   std::vector<double> L(size * size, 0.0);
+   for (unsigned int j = 0; j < size; j++)
+   {
+      double diag = normalMatrix[j*size + j];
+      for (unsigned int k = 0; k < j; k++)
+         diag -= L[j*size + k] * L[j*size + k];
+
+      // A vanishing pivot means that the samples do not cover enough of the
+      // circle to tell the harmonics apart.
+      if (diag <= 1e-9 * normalMatrix[j*size + j])
+         return false;
+      L[j*size + j] = std::sqrt(diag);
+
+      for (unsigned int i = j + 1; i < size; i++)
+      {
+         double sum = normalMatrix[j*size + i];
+         for (unsigned int k = 0; k < j; k++)
+            sum -= L[i*size + k] * L[j*size + k];
+         L[i*size + j] = sum / L[j*size + j];
+      }
+   }
+
+   // Forward and back substitution.
+   std::vector<double> y(size);
+   for (unsigned int i = 0; i < size; i++)
+   {
+      double sum = normalVector[i];
+      for (unsigned int k = 0; k < i; k++)
+         sum -= L[i*size + k] * y[k];
+      y[i] = sum / L[i*size + i];
+   }
+   for (int i = size - 1; i >= 0; i--)
+   {
+      double sum = y[i];
+      for (unsigned int k = i + 1; k < size; k++)
+         sum -= L[k*size + i] * solution[k];
+      solution[i] = sum / L[i*size + i];
+   }
+
+   for (unsigned int i = 0; i < 2 * order; i++)
+      coeffs[i] = solution[i + 1];
+   return true;
+}
+
+
+degrees HarmonicFit::residual(RawAngle raw, degrees reference) const
+{
+   std::vector<double> p(size);
+   basis(raw.val, p.data());
+
+   double model = 0;
+   for (unsigned int i = 0; i < size; i++)
+      model += solution[i] * p[i];
+   return deviation(raw, reference) - model;
+}
+
+
+degrees HarmonicFit::rmsResidual() const
+{
+   // At the least-squares solution, the sum of squared residuals equals
+   // sum(d^2) - x^T * b, so there is no need to revisit the samples.
+   if (count == 0)
+      return 0;
+
+   double ssr = sumSquares;
+   for (unsigned int i = 0; i < size; i++)
+      ssr -= solution[i] * normalVector[i];
+   return std::sqrt(std::max(ssr, 0.0) / count);
+}
+
+
+void ResidualStats::add(degrees residual)
+{
+   count++;
+   sumSquares += residual * residual;
+   if (std::abs(residual) > maximum)
+      maximum = std::abs(residual);
+}
+
+
+degrees ResidualStats::rms() const
+{
+   return (count ? std::sqrt(sumSquares / count) : 0);
+}
+
+
+/* Calls a function for every (raw, reference) pair found in the table. */
+template <class Function>
+static void readReferenceTable(std::istream& table, Function f)
+{
+   std::string line;
+   unsigned long lineNumber = 0;
+   while (std::getline(table, line))
+   {
+      lineNumber++;
+      std::istringstream fields(line);
+      std::string first;
+      if (!(fields >> first) || first[0] == '#')
+         continue;
+
+      degrees raw, reference;
+      if (!(std::istringstream(first) >> raw) || !(fields >> reference))
+      {
+         std::ostringstream message;
+         message << "reference table: malformed line " << lineNumber;
+         throw CalibrationException(message.str());
+      }
+      f(RawAngle(mod360(raw)), reference);
+   }
+}
+
+
+void fitReferenceTable(std::istream& table, HarmonicFit& fit)
+{
+   readReferenceTable(table, [&fit](RawAngle raw, degrees reference)
+      { fit.addSample(raw, reference); });
+}
+
+
+void checkReferenceTable(std::istream& table, const HarmonicFit& fit,
+                         ResidualStats& stats)
+{
+   readReferenceTable(table, [&fit, &stats](RawAngle raw, degrees reference)
+      { stats.add(fit.residual(raw, reference)); });
+}
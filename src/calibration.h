@@ -0,0 +1,121 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <exception>
+#include <istream>
+#include <string>
+#include <vector>
+#include "angles.h"
+
+class CalibrationException : public std::exception
+{
+public:
+   CalibrationException(const std::string& what) : message(what) {}
+   inline const char* what() { return message.c_str(); }
+   const std::string message;
+};
+
+
+/* Least-squares fit of the linearization coefficients.
+ *
+ * The fit is performed on pairs of (raw, reference) angles, where the
+ * reference is the true axis orientation as measured by some independent
+ * means. The deviation of the raw angle from the reference is modelled as
+ *
+ * raw - reference = c + k(1,1)*cos(1*raw) + k(1,2)*sin(1*raw)
+ *                     + k(2,1)*cos(2*raw) + k(2,2)*sin(2*raw)
+ *                     + ...
+ *
+ * which is exactly the correction that CookedAngle::linearize() subtracts.
+ * The constant c absorbs the offset between the raw and the reference scale
+ * and is not a part of the linearization.
+ *
+ * Samples are accumulated into the normal equations as they arrive, so the
+ * memory consumption does not depend on the number of samples.
+*/
+class HarmonicFit
+{
+public:
+   HarmonicFit(unsigned int order);
+
+   void addSample(RawAngle raw, degrees reference);
+
+   // Solve the normal equations. Returns false if the samples do not
+   // determine the coefficients (e.g., too narrow a range of raw angles).
+   bool solve();
+
+   // Coefficients in the order expected by CookedAngle::setLinearization().
+   // Only valid after a successful solve().
+   inline const std::vector<float>& coefficients() const { return coeffs; }
+
+   // Deviation of a sample from the fitted model.
+   degrees residual(RawAngle raw, degrees reference) const;
+
+   // RMS residual of the accumulated samples with respect to the solution.
+   degrees rmsResidual() const;
+
+   inline unsigned long samples() const { return count; }
+   inline unsigned int getOrder() const { return order; }
+
+private:
+   // Evaluate the model basis functions (1, cos(raw), sin(raw), cos(2*raw),
+   // ...) at the given angle.
+   void basis(degrees raw, double* phi) const;
+
+   // Deviation of raw from reference, unwrapped relative to the first sample.
+   degrees deviation(RawAngle raw, degrees reference) const;
+
+   unsigned int order;
+   unsigned int size;
+   std::vector<double> normalMatrix;
+   std::vector<double> normalVector;
+   std::vector<double> phi;
+   std::vector<double> solution;
+   std::vector<float> coeffs;
+   double sumSquares = 0;
+   unsigned long count = 0;
+   degrees firstDeviation = 0;
+};
+
+
+// Running statistics of the residuals of a fit.
+struct ResidualStats
+{
+   void add(degrees residual);
+   degrees rms() const;
+
+   unsigned long count = 0;
+   double sumSquares = 0;
+   degrees maximum = 0;
+};
+
+
+/* Reading of reference tables. A reference table is a text file with one
+ * "<raw angle> <reference angle>" pair per line. Empty lines and lines
+ * starting with '#' are ignored.
+*/
+void fitReferenceTable(std::istream& table, HarmonicFit& fit);
+void checkReferenceTable(std::istream& table, const HarmonicFit& fit,
+                         ResidualStats& stats);
+
+#endif // CALIBRATION_H
@@ -20,27 +20,72 @@
 
 #include <iostream>
 #include <cmath>
-#include <thread>
 #include <string>
 #include <cstdio>
+#include <cstring>
 #include <atomic>
-#include <csignal>
-#include <list>
 #include <algorithm>
+#include <sstream>
+#include <unistd.h>
 #include <libconfig.h++>
+#include "allocguard.h"
+#include "output.h"
+#include "trace.h"
 #include "controller.h"
+#include "indicator.h"
 
 #ifdef HARDWARE
    #include <wiringPi.h>
    #include <wiringPiSPI.h>
    #include <linux/spi/spidev.h>
-   #include "hardware.h"
+#endif
+
+/* The path of a file named in the configuration file: relative names are
+ * taken relative to the directory of the configuration file.
+*/
+static std::string besideConfigFile(const char* configFile, const char* name)
+{
+   std::string path(name);
+   if (!path.empty() && path[0] != '/')
+   {
+      std::string directory(configFile);
+      size_t slash = directory.rfind('/');
+      if (slash != std::string::npos)
+         path = directory.substr(0, slash + 1) + path;
+   }
+   return path;
+}
+
+
+/* The files that mcontrol writes itself (the motor model, the friction map
+ * and the slew history) go to the state directory in the builds that have one (the hardware
+ * builds, which keep the configuration file in /etc), and beside the
+ * configuration file otherwise. Full paths are taken as they are.
+*/
+static std::string stateFile(const char* configFile, const char* name)
+{
+#ifdef STATE_FILE_PATH
+   std::string path(name);
+   if (!path.empty() && path[0] != '/')
+      path = STATE_FILE_PATH "/" + path;
+   return path;
 #else
-   #include "simulated.h"
+   return besideConfigFile(configFile, name);
 #endif
+}
+
 
 ControllerParams::ControllerParams(const char* filename)
 {
+   // The safe limits, the user origin and the park position can only be
+   // worked out with the new angle scales in effect. They are put in effect
+   // just for that; the previous ones come back whatever happens.
+   struct RestoreScales
+   {
+      AngleScales previous;
+      ~RestoreScales() { previous.apply(); }
+   } restoreScales = { AngleScales::current() };
+
    libconfig::Config config;
    config.readFile(filename);
    config.setAutoConvert(true);
@@ -57,6 +102,63 @@ ControllerParams::ControllerParams(const char* filename)
    destallDuration =
       std::chrono::milliseconds((unsigned int)config.lookup("motor.destallDuration"));
    destallTries = (unsigned int)config.lookup("motor.destallTries");
+   pwmRange = (unsigned int)config.lookup("motor.pwmRange");
+   pwmFrequency = (unsigned int)config.lookup("motor.pwmFrequency");
+   if (pwmRange < 100 || pwmFrequency == 0)
+      throw ConfigFileException("motor.pwmRange must be at least 100 and "
+                                "motor.pwmFrequency above zero");
+   bridge.releaseTime =
+      std::chrono::milliseconds((unsigned int)config.lookup("motor.relayReleaseTime"));
+   bridge.settleTime =
+      std::chrono::milliseconds((unsigned int)config.lookup("motor.relaySettleTime"));
+   bridge.rampTime =
+      std::chrono::milliseconds((unsigned int)config.lookup("motor.pwmRampTime"));
+
+   // The motor model lives in a file of its own, in the state directory
+   // (see stateFile()). There is none until the motor is identified
+   // ("mcontrol --identify").
+   const char* modelName = config.lookup("motor.model");
+   modelFile = stateFile(filename, modelName);
+   if (!modelFile.empty() && access(modelFile.c_str(), F_OK) == 0)
+   {
+      bool loaded = false;
+      try
+      {
+         loaded = model.load(modelFile.c_str());
+      }
+      catch (libconfig::ConfigException& e)
+      {
+      }
+      if (!loaded)
+         throw ConfigFileException("could not load the motor model from '" +
+                                   modelFile + "'");
+   }
+
+   // Likewise the friction map, which is created by the first slew. A map
+   // that can not be read is started over.
+   const char* frictionName = config.lookup("motor.frictionMap");
+   frictionFile = stateFile(filename, frictionName);
+   if (!frictionFile.empty() && access(frictionFile.c_str(), F_OK) == 0)
+   {
+      bool loaded = false;
+      try
+      {
+         loaded = friction.load(frictionFile.c_str());
+      }
+      catch (libconfig::ConfigException& e)
+      {
+      }
+      if (!loaded)
+      {
+         std::cerr << "warning: ignoring the friction map in '"
+                   << frictionFile << "'\n";
+         friction = FrictionMap();
+      }
+   }
+
+   // The slew history, likewise in the state directory.
+   const char* historyName = config.lookup("history.file");
+   historyFile = stateFile(filename, historyName);
 
    // angle conversions
    libconfig::Setting& linArray = config.lookup("angles.linearization");
@@ -107,189 +209,417 @@ ControllerParams::ControllerParams(const char* filename)
 
    // control loop parameters
    tolerance = config.lookup("movement.tolerance");
-   loopDelay = std::chrono::milliseconds(10);
+   loopDelay =
+      std::chrono::milliseconds((unsigned int)config.lookup("loop.loopDelay"));
+   plateauLoopDelay =
+      std::chrono::milliseconds((unsigned int)config.lookup("loop.plateauLoopDelay"));
+   approachLoopDelay =
+      std::chrono::milliseconds((unsigned int)config.lookup("loop.approachLoopDelay"));
+   approachAngle = config.lookup("loop.approachAngle");
+   minReadouts = (unsigned int)config.lookup("loop.minReadouts");
+   maxReadouts = (unsigned int)config.lookup("loop.maxReadouts");
+   if (loopDelay.count() == 0 || plateauLoopDelay.count() == 0 ||
+       approachLoopDelay.count() == 0)
+      throw ConfigFileException("loop delays must be above zero");
+   if (minReadouts < 3 || minReadouts > maxReadouts ||
+       maxReadouts > SensorNoise::maxReadouts)
+   {
+      std::ostringstream message;
+      message << "loop.minReadouts and loop.maxReadouts must satisfy "
+              << "3 <= minReadouts <= maxReadouts <= " << SensorNoise::maxReadouts;
+      throw ConfigFileException(message.str());
+   }
+
+   // safety watchdog
+   watchdog.enabled = config.lookup("watchdog.enabled");
+   watchdog.period =
+      std::chrono::milliseconds((unsigned int)config.lookup("watchdog.period"));
+   watchdog.heartbeatTimeout =
+      std::chrono::milliseconds((unsigned int)config.lookup("watchdog.heartbeatTimeout"));
+   watchdog.maxVelocity = config.lookup("watchdog.maxVelocity");
+   watchdog.limitMargin = config.lookup("watchdog.limitMargin");
+   watchdog.priority = config.lookup("watchdog.priority");
+   if (watchdog.period.count() == 0)
+      throw ConfigFileException("watchdog.period must be above zero");
+
+   angleScales = AngleScales::current();
 }
 
 
-Controller::Controller(ControllerParams initialParams) :
-   params(initialParams)
+ControllerParams readControllerParams(const char* filename)
 {
-   // setup
-#ifdef HARDWARE
-   if (wiringPiSetup() == -1)
+   std::ostringstream message;
+   try
    {
-      perror("wiringPiSetup");
-      exit(2);
+      return ControllerParams(filename);
    }
-
-   int fd = wiringPiSPISetupMode(0, 500000, SPI_MODE_1);
-   if (fd == -1)
+   catch (libconfig::FileIOException& e)
    {
-      perror("wiringPiSPISetupMode");
-      exit(2);
+      message << "could not read '" << filename << "'";
+   }
+   catch (libconfig::ParseException& e)
+   {
+      message << "error parsing '" << e.getFile() << "', line " << e.getLine()
+              << ": " << e.getError();
+   }
+   catch (libconfig::SettingTypeException& e)
+   {
+      message << "wrong argument type for setting '" << e.getPath() << "'";
+   }
+   catch (libconfig::SettingNotFoundException& e)
+   {
+      message << "could not find setting '" << e.getPath() << "'";
    }
+   throw ConfigFileException(message.str());
+}
+
 
+ControllerParams loadControllerParams(const char* filename)
+{
+   ControllerParams params = readControllerParams(filename);
+   params.angleScales.apply();
+   return params;
+}
+
+
+ControllerBackend::ControllerBackend() :
+   initialized(initialize()),
+#ifdef HARDWARE
    // Eeek! Hardcoded magic numbers!!
    // Seriously, if you came so far as to need this program, you are more
    // than well equipped to know what to set these to.
-   motor = new HardwareMotor(4, 5, 1);
-   sensor = new HardwareSensor;
+   motor(4, 5, 1),
+   sensor()
 #else
-   motor = new SimulatedMotor(30);
-   sensor = new SimulatedSensor(dynamic_cast<SimulatedMotor*>(motor));
+   motor(30),
+   sensor(&motor)
 #endif
+{}
+
 
-   motor->invertPolarity(params.invertMotorPolarity);
+int ControllerBackend::initialize()
+{
+#ifdef HARDWARE
+   if (wiringPiSetup() == -1)
+      throw HardwareException(std::string("wiringPiSetup: ") + strerror(errno));
+
+   int fd = wiringPiSPISetupMode(0, 500000, SPI_MODE_1);
+   if (fd == -1)
+      throw HardwareException(std::string("wiringPiSPISetupMode: ") +
+                              strerror(errno));
+#endif
+   return 0;
 }
 
 
-RawAngle Controller::getRawAngle() const
+std::unique_ptr<BackendSensor> ControllerBackend::createReferenceSensor()
 {
-   return sensor->getRawAngle();
+#ifdef HARDWARE
+   // The reference encoder is connected to the SPI channel 1.
+   if (wiringPiSPISetupMode(1, 500000, SPI_MODE_1) == -1)
+   {
+      perror("wiringPiSPISetupMode");
+      return nullptr;
+   }
+   return std::unique_ptr<BackendSensor>(new HardwareSensor(1));
+#else
+   // A nearly perfect sensor.
+   return std::unique_ptr<BackendSensor>(new SimulatedSensor(&motor, 0.01, 0));
+#endif
 }
 
 
-CookedAngle Controller::getCookedAngle() const
+Controller::Controller(const ControllerParams& initialParams) :
+   BasicController<BackendMotor, BackendSensor>(
+      initialParams, ControllerBackend::motor, ControllerBackend::sensor),
+   watchdog(ControllerBackend::motor, ControllerBackend::sensor,
+            initialParams.watchdog)
 {
-   std::list<CookedAngle> readouts;
-   // This parameter was deemed too obscure to be put in the config file.
-   const unsigned int numberOfReadouts = 5;
+   ControllerBackend::motor.configurePWM(initialParams.pwmRange,
+                                         initialParams.pwmFrequency);
+   setWatchdog(&watchdog);
+}
 
-   // Read a few consecutive values from the sensor.
-   for (unsigned int i = 0; i < numberOfReadouts; i++)
-      readouts.emplace_back(sensor->getRawAngle());
 
-   // Get rid of the minimum and maximum value, hopefully throwing out any
-   // erroneous readings.
-   readouts.erase(std::min_element(readouts.begin(), readouts.end()));
-   readouts.erase(std::max_element(readouts.begin(), readouts.end()));
+void Controller::setParams(const ControllerParams& newParams)
+{
+   BasicController<BackendMotor, BackendSensor>::setParams(newParams);
+   ControllerBackend::motor.configurePWM(newParams.pwmRange,
+                                         newParams.pwmFrequency);
+}
+
 
-   // Of the remaining values, return the most recent one.
-   return readouts.back();
+ReturnValue Controller::calibrationSweep(HarmonicFit& fit,
+                                         ResidualStats& residuals)
+{
+   auto reference = createReferenceSensor();
+   if (!reference)
+      return ReturnValue::HardwareError;
+   return calibrationSweep(*reference, fit, residuals);
 }
 
 
-UserAngle Controller::getUserAngle() const
+template <class MotorType, class SensorType>
+BasicController<MotorType, SensorType>::BasicController(
+   const ControllerParams& initialParams, MotorType& motor_, SensorType& sensor_) :
+   params(initialParams), motor(motor_), sensor(sensor_),
+   bridge(motor_, initialParams.bridge), friction(initialParams.friction),
+   interruptRequests(0)
 {
-   return UserAngle(getCookedAngle());
+   motor.invertPolarity(params.invertMotorPolarity);
+   estimator.configure(params);
 }
 
 
-/* An abstract progress indicator. It provides the core of a progress indicator
- * that prints the current state at predetermined time intervals.
-*/
-class ProgressIndicator
+template <class MotorType, class SensorType>
+void BasicController<MotorType, SensorType>::setParams(
+   const ControllerParams& newParams)
 {
-public:
-   ProgressIndicator(CookedAngle initial_, CookedAngle target_) :
-      initial(0), target(0)
-   {
-      reset(initial_, target_);
-   }
+   params = newParams;
+   friction = params.friction;
+   bridge.setTiming(params.bridge);
+   motor.invertPolarity(params.invertMotorPolarity);
+   estimator.configure(params);
+   if (watchdog)
+      watchdog->setParams(params.watchdog);
+}
 
-   virtual ~ProgressIndicator() = default;
 
-   // Print the current progress if either enough time has elapsed from the
-   // previous printing or the forcePrint parameter is true.
-   void print(CookedAngle angle, bool forcePrint = false)
-   {
-      auto now = std::chrono::steady_clock::now();
-      if (!forcePrint && now < previousPrint + printPeriod)
-         return;
-      previousPrint = now;
-      printProgress(angle);
-   }
+template <class MotorType, class SensorType>
+void BasicController<MotorType, SensorType>::setWatchdog(Watchdog* watchdog_)
+{
+   watchdog = watchdog_;
+   bridge.setWatchdog(watchdog);
+}
 
-   // Set new initial and target angles.
-   void reset(CookedAngle initial_, CookedAngle target_)
-   {
-      initial = initial_;
-      target = target_;
-      previousPrint = std::chrono::steady_clock::now() - printPeriod;
-   }
 
-   // Finalize the output (for example, by printing a final newline).
-   virtual void finalize() = 0;
+template <class MotorType, class SensorType>
+void BasicController<MotorType, SensorType>::resetSafetyTrip()
+{
+   if (watchdog)
+      watchdog->reset();
+}
 
-protected:
-   // Do the actual printing.
-   virtual void printProgress(CookedAngle angle) = 0;
 
-   CookedAngle initial;
-   CookedAngle target;
-   std::chrono::steady_clock::time_point previousPrint;
+template <class MotorType, class SensorType>
+std::unique_lock<PriorityInheritanceMutex> BasicController<MotorType, SensorType>::lockHardware() const
+{
+   if (watchdog)
+      return std::unique_lock<PriorityInheritanceMutex>(watchdog->hardwareMutex());
+   return std::unique_lock<PriorityInheritanceMutex>();
+}
 
-   static const int length = 30;
-   static constexpr std::chrono::milliseconds printPeriod{100};
-};
 
-// definitions for the above static consts
-const int ProgressIndicator::length;
-constexpr std::chrono::milliseconds ProgressIndicator::printPeriod;
+template <class MotorType, class SensorType>
+void BasicController<MotorType, SensorType>::setStatistics(
+   SlewStatistics* statistics_)
+{
+   statistics = statistics_;
+}
 
 
-// An ASCII progress bar.
-class BarIndicator : public ProgressIndicator
+template <class MotorType, class SensorType>
+void BasicController<MotorType, SensorType>::setStatusPublisher(
+   StatusPublisher* publisher)
 {
-public:
-   BarIndicator(CookedAngle initial_, CookedAngle target_) :
-      ProgressIndicator(initial_, target_) {}
+   statusPublisher = publisher;
+}
+
+
+template <class MotorType, class SensorType>
+RawAngle BasicController<MotorType, SensorType>::getRawAngle() const
+{
+   auto lock = lockHardware();
+   return sensor.getRawAngle();
+}
+
+
+template <class MotorType, class SensorType>
+CookedAngle BasicController<MotorType, SensorType>::getCookedAngle() const
+{
+   return measureAngle(noise.readoutsFor(params.tolerance / 3,
+                                         params.minReadouts, params.maxReadouts));
+}
 
-   virtual void finalize()
-   {
-      std::cout << std::endl;
-   }
 
-private:
-   virtual void printProgress(CookedAngle angle)
+template <class MotorType, class SensorType>
+CookedAngle BasicController<MotorType, SensorType>::measureAngle(
+   unsigned int numberOfReadouts) const
+{
+   degrees readouts[SensorNoise::maxReadouts];
+   RawCode::value_type codes[SensorNoise::maxReadouts];
+
+   StageTimer timer(statistics, &SlewStatistics::cookedAngle);
+   TRACE_SPAN("getCookedAngle");
+
+   // Read a few consecutive values from the sensor.
+   for (unsigned int i = 0; i < numberOfReadouts; i++)
    {
-      std::string bar(length, '-');
-      int position = std::round(length * (angle - initial)/(target - initial));
-      position = std::min(std::max( position, 0), length - 1);
-      bar.replace (0,  position,  position, '=');
-      bar[position] = '>';
-      printf("\r\033[K%6.1f degrees %s", UserAngle(angle).val, bar.c_str());
-      fflush(stdout);
+      StageTimer readoutTimer(statistics, &SlewStatistics::sensorReadout);
+      TRACE_SPAN("sensor readout");
+      auto lock = lockHardware();
+      RawCode code = sensor.getRawCode();
+      codes[i] = code.val;
+      readouts[i] = CookedAngle(code).val;
    }
 
-   // Length of the bar in characters.
-   static const int length = 30;
-};
+   // Sort the readouts (there are only a few of them).
+   for (unsigned int i = 1; i < numberOfReadouts; i++)
+      for (unsigned int j = i; j > 0 && readouts[j - 1] > readouts[j]; j--)
+      {
+         std::swap(readouts[j - 1], readouts[j]);
+         std::swap(codes[j - 1], codes[j]);
+      }
+
+   // Get rid of the extreme values, hopefully throwing out any erroneous
+   // readings, and average the remaining ones.
+   unsigned int trim = noise.trimFor(numberOfReadouts);
+   degrees sum = 0;
+   for (unsigned int i = trim; i < numberOfReadouts - trim; i++)
+      sum += readouts[i];
+   degrees filtered = sum / (numberOfReadouts - 2 * trim);
+   noise.update(readouts, numberOfReadouts, filtered);
+
+   lastRawCode = RawCode(codes[numberOfReadouts / 2]);
+   return CookedAngle(filtered);
+}
 
 
-/* An indicator with simple numeric output suitable for further processing.
- * It outputs lines with the format:
- *
- * <current angle> <progress percent>
+template <class MotorType, class SensorType>
+UserAngle BasicController<MotorType, SensorType>::getUserAngle() const
+{
+   return UserAngle(getCookedAngle());
+}
+
+
+template <class MotorType, class SensorType>
+void BasicController<MotorType, SensorType>::interrupt()
+{
+   interruptRequests++;
+   events.notify();
+}
+
+
+template <class MotorType, class SensorType>
+void BasicController<MotorType, SensorType>::setSignalHandling(bool enable)
+{
+   handleSignals = enable;
+}
+
+
+/* The number of interruptions of the current slew (Ctrl+C presses and the
+ * like). Helps us to estimate the user's panic level and act accordingly. :-)
+ * These are the requests made by interrupt() plus the signals received since
+ * signalBaseline was taken.
 */
-class PercentIndicator : public ProgressIndicator
+template <class MotorType, class SensorType>
+int BasicController<MotorType, SensorType>::interruptCount(int signalBaseline) const
 {
-public:
-   PercentIndicator(CookedAngle initial_, CookedAngle target_) :
-      ProgressIndicator(initial_, target_) {}
+   return interruptRequests + events.signalCount() - signalBaseline;
+}
+
+
+SlewHandle::SlewHandle(std::function<void()> interrupt,
+                       std::function<StatusSnapshot()> status) :
+   interruptFunction(interrupt), statusFunction(status)
+{}
 
-   virtual void finalize() {}
 
-private:
-   virtual void printProgress(CookedAngle angle)
+SlewHandle::~SlewHandle()
+{
+   if (slewThread.joinable())
+      slewThread.join();
+   if (notifierThread.joinable())
+      notifierThread.join();
+}
+
+
+void SlewHandle::start(std::function<ReturnValue()> run,
+                       ProgressCallback progress, CompletionCallback completion,
+                       std::chrono::milliseconds progressPeriod)
+{
+   bool notifier = progress || completion;
+   uint64_t initialTick = statusFunction().tick;
+
+   slewThread = std::thread([this, run, notifier]()
+      {
+         ReturnValue outcome = run();
+         std::lock_guard<std::mutex> lock(mutex);
+         result = outcome;
+         slewDone = true;
+         if (!notifier)
+            finished = true;
+         condition.notify_all();
+      });
+
+   if (notifier)
+      notifierThread = std::thread(&SlewHandle::notify, this, progress,
+                                   completion, progressPeriod, initialTick);
+}
+
+
+void SlewHandle::notify(ProgressCallback progress, CompletionCallback completion,
+                        std::chrono::milliseconds progressPeriod,
+                        uint64_t initialTick)
+{
+   blockSignalsInThread();
+   uint64_t lastTick = initialTick;
+
+   std::unique_lock<std::mutex> lock(mutex);
+   while (!slewDone)
    {
-      printf("%.1f %d\n",
-             UserAngle(angle).val,
-             (int)std::round(100 * (angle - initial)/(target - initial)));
-      fflush(stdout);
+      condition.wait_for(lock, progressPeriod);
+      if (slewDone)
+         break;
+
+      lock.unlock();
+      StatusSnapshot status = statusFunction();
+      if (progress && status.tick != lastTick)
+      {
+         progress(status);
+         lastTick = status.tick;
+      }
+      lock.lock();
    }
-};
+   ReturnValue outcome = result;
+   lock.unlock();
+
+   StatusSnapshot status = statusFunction();
+   if (progress && status.tick != lastTick)
+      progress(status);
+   if (completion)
+      completion(outcome);
+
+   lock.lock();
+   finished = true;
+   condition.notify_all();
+}
+
+
+ReturnValue SlewHandle::wait()
+{
+   std::unique_lock<std::mutex> lock(mutex);
+   condition.wait(lock, [this]() { return finished; });
+   return result;
+}
 
 
-// The number of SIGINTs (Ctrl+C) received during the slew.
-// Helps us to estimate the user's panic level and act accordingly. :-)
-std::atomic_int timesInterrupted(0);
+bool SlewHandle::poll(ReturnValue* result_) const
+{
+   std::lock_guard<std::mutex> lock(mutex);
+   if (finished && result_)
+      *result_ = result;
+   return finished;
+}
+
 
-// SIGINT handler
-void int_handler(int sig)
+void SlewHandle::cancel(Cancel mode)
 {
-   timesInterrupted++;
-   signal(SIGINT, int_handler);
+   if (poll())
+      return;
+   interruptFunction();
+   if (mode == Cancel::Immediate)
+      interruptFunction();
 }
 
 
@@ -297,49 +627,171 @@ void int_handler(int sig)
 **** THE MEAT OF THE STUFF ***
 ******************************/
 
-ReturnValue Controller::slew(CookedAngle targetAngle)
+template <class MotorType, class SensorType>
+ReturnValue BasicController<MotorType, SensorType>::slew(CookedAngle targetAngle)
 {
-   ReturnValue retval = ReturnValue::Success;
+   if (slewInProgress.exchange(true))
+   {
+      fprintf(stderr, "Another slew is in progress.\n");
+      return ReturnValue::SlewNotFinished;
+   }
+   interruptRequests = 0;
+   ReturnValue retval = runSlew(targetAngle, false);
+   saveFrictionMap();
+   saveHistory();
+   slewInProgress = false;
+   return retval;
+}
+
 
-   enum class SlewPhase
+template <class MotorType, class SensorType>
+std::unique_ptr<SlewHandle> BasicController<MotorType, SensorType>::slewAsync(
+   CookedAngle targetAngle, SlewHandle::ProgressCallback progress,
+   SlewHandle::CompletionCallback completion,
+   std::chrono::milliseconds progressPeriod)
+{
+   if (slewInProgress.exchange(true))
+      return nullptr;
+   interruptRequests = 0;
+
+   std::unique_ptr<SlewHandle> handle(new SlewHandle(
+      [this]() { interrupt(); },
+      [this]() { return currentStatus(); }));
+   handle->start([this, targetAngle]()
+      {
+         ReturnValue retval = runSlew(targetAngle, true);
+         saveFrictionMap();
+         saveHistory();
+         slewInProgress = false;
+         return retval;
+      },
+      progress, completion, progressPeriod);
+   return handle;
+}
+
+
+/* The slew itself. A background slew leaves the signals alone and does not
+ * print its progress.
+*/
+template <class MotorType, class SensorType>
+ReturnValue BasicController<MotorType, SensorType>::runSlew(
+   CookedAngle targetAngle, bool background)
+{
+   lastSlew.time = 0;
+   if (safetyTripped())
    {
-      accelerating,
-      plateau,
-      decelerating
-   };
+      fprintf(stderr, "The watchdog has tripped (%s); not slewing.\n",
+              Watchdog::describe(watchdog->reason()));
+      return ReturnValue::SafetyTrip;
+   }
 
+   ReturnValue retval = ReturnValue::Success;
    SlewPhase phase = SlewPhase::accelerating;
-   int interruptsHandled = 0;
-   signal(SIGINT, int_handler);
+   MotorStatus motorState = MotorStatus::Undetermined;
+   Fault fault = Fault::None;
+   bool interruptHandled = false;
+   bool catchSignals = handleSignals && !background;
+   int signalBaseline = events.signalCount();
+   if (catchSignals && !events.catchSignals())
+   {
+      perror("signalfd");
+      return ReturnValue::HardwareError;
+   }
 
    // Determine which direction to turn and enage the H-bridge accordingly.
    CookedAngle initialAngle = getCookedAngle();
    float direction = (targetAngle.val > initialAngle.val ? 1.0 : -1.0);
-
-   if (direction > 0)
-      motor->turnOnDirPositive();
-   else
-      motor->turnOnDirNegative();
-
-   // Create a progress indicator.
+   auto slewStart = std::chrono::steady_clock::now();
+   lastSlew = SlewRecord();
+   lastSlew.time = std::chrono::duration_cast<std::chrono::seconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+   lastSlew.startAngle = initialAngle.val;
+   lastSlew.targetAngle = targetAngle.val;
+   engage(direction);
+   if (watchdog)
+      watchdog->arm(direction);
+
+   // Pick a progress indicator.
+   BarIndicator barIndicator(initialAngle, targetAngle);
+   PercentIndicator percentIndicator(initialAngle, targetAngle);
+   NullIndicator nullIndicator(initialAngle, targetAngle);
    ProgressIndicator* progressIndicator;
-   if (params.indicatorStyle == ControllerParams::IndicatorStyle::Bar)
-      progressIndicator = new BarIndicator(initialAngle, targetAngle);
+   if (background)
+      progressIndicator = &nullIndicator;
+   else if (params.indicatorStyle == ControllerParams::IndicatorStyle::Bar)
+      progressIndicator = &barIndicator;
+   else if (params.indicatorStyle == ControllerParams::IndicatorStyle::Percent)
+      progressIndicator = &percentIndicator;
    else
-      progressIndicator = new PercentIndicator(initialAngle, targetAngle);
+      progressIndicator = &nullIndicator;
+
+   // All output of the slew is written by the output thread, so that a slow
+   // terminal can not hold up the control loop.
+   asyncOutput().start();
+   progressIndicator->print(initialAngle, true);
+
+   // From here on, the slew must not touch the heap (see allocguard.h).
+   TRACE_THREAD("control");
+   NoAllocationScope noAllocations;
+   TRACE_SPAN("slew");
 
    // Start motor monitoring. This will take a record of the angle just before
    // we apply power to the motor.
    beginMotorMonitoring(initialAngle);
    int initialStallsPermitted = params.destallTries;
-
-   // Main control loop.
+   float periodMaxDuty = 0;
+   statusAngle = initialAngle;
+   statusVelocity = 0;
+   statusTime = std::chrono::steady_clock::now();
+   CookedAngle angle = initialAngle;
+
+   // Main control loop. It runs on the ticks of the event loop, but also
+   // right away when an interruption arrives.
+   std::chrono::milliseconds tickPeriod = params.loopDelay;
+   unsigned int readouts = noise.readoutsFor(params.tolerance,
+                                             params.minReadouts, params.maxReadouts);
+   bool ticking = events.startTicks(tickPeriod);
    while (true)
    {
-      CookedAngle angle = getCookedAngle();
+      TRACE_SPAN("iteration");
+
+      // A second interruption means an emergency stop, which must not wait
+      // for anything (not even for the sensor).
+      if (interruptCount(signalBaseline) > 1)
+      {
+         asyncOutput().message(stderr, "\nEmergency stop. Hold on to your gears!");
+         retval = ReturnValue::SlewNotFinished;
+         fault = Fault::EmergencyStop;
+         break;
+      }
+
+      // Without the ticks, the loop can not keep its pace (or even sleep).
+      if (!ticking)
+      {
+         asyncOutput().message(stderr, "\nThe loop timer failed!");
+         retval = ReturnValue::HardwareError;
+         break;
+      }
+
+      // The watchdog has already cut the power if it tripped; all that is
+      // left is to stop the loop.
+      if (safetyTripped())
+      {
+         retval = ReturnValue::SafetyTrip;
+         fault = Fault::SafetyTrip;
+         break;
+      }
+      if (watchdog)
+         watchdog->heartbeat();
+
+      angle = measureAngle(readouts);
       degrees diffInitial = direction * (angle - initialAngle);
       degrees diffTarget = direction * (targetAngle - angle);
-      progressIndicator->print(angle);
+      {
+         StageTimer timer(statistics, &SlewStatistics::progress);
+         TRACE_SPAN("progress");
+         progressIndicator->print(angle);
+      }
 
       if (diffTarget < params.tolerance)
       {
@@ -351,25 +803,28 @@ ReturnValue Controller::slew(CookedAngle targetAngle)
       // Now determine the slew phase that we are in and the needed PWM duty
       // cycle. We do this by calculating the duties for both accelerating and
       // decelerating and then taking the lower one.
-      const float dutySpan = params.maxDuty - params.minDuty;
-      float dutyInitial = (diffInitial / params.accelAngle) * dutySpan + params.minDuty;
-      float dutyTarget = ((diffTarget - params.tolerance) / params.accelAngle) * dutySpan + params.minDuty;
-      int duty;
+      // The lowest duty is the one that keeps the axis moving at this angle.
+      StageTimer dutyTimer(statistics, &SlewStatistics::dutyComputation);
+      const float minDuty = friction.minDuty(angle, params.minDuty);
+      const float dutySpan = params.maxDuty - minDuty;
+      float dutyInitial = (diffInitial / params.accelAngle) * dutySpan + minDuty;
+      float dutyTarget = ((diffTarget - params.tolerance) / params.accelAngle) * dutySpan + minDuty;
+      float duty;
 
       if (dutyInitial <= dutyTarget)
       {
          phase = SlewPhase::accelerating;
-         duty = round(dutyInitial);
+         duty = dutyInitial;
       }
       else
       {
          phase = SlewPhase::decelerating;
-         duty = round(dutyTarget);
+         duty = dutyTarget;
       }
 
       // Clamp the duty cycle if it is outside the wanted range.
-      if (duty < params.minDuty)
-         duty = params.minDuty;
+      if (duty < minDuty)
+         duty = minDuty;
       else if (duty >= params.maxDuty)
       {
          // Notice that for short slews, there can be no plateau.
@@ -377,33 +832,75 @@ ReturnValue Controller::slew(CookedAngle targetAngle)
          duty = params.maxDuty;
       }
 
-      motor->setPWM(duty);
+      // With a motor model, command the duty that the velocity profile
+      // needs right away.
+      if (params.model.valid() && phase == SlewPhase::accelerating)
+         duty = feedforwardDuty(diffInitial, true, minDuty);
+      else if (params.model.valid() && phase == SlewPhase::decelerating)
+         duty = feedforwardDuty(diffTarget - params.tolerance, false, minDuty);
+      periodMaxDuty = std::max(periodMaxDuty, duty);
+
+      dutyTimer.stop();
 
-      // Check on what the axis is actually doing.
+      {
+         StageTimer timer(statistics, &SlewStatistics::setPWM);
+         TRACE_SPAN("setPWM");
+         setDuty(duty, minDuty);
+      }
+
+      // Check on what the axis is actually doing, and learn from it where
+      // the friction is.
       MotorStatus status = checkMotor(angle, direction);
+      if (status != MotorStatus::Undetermined)
+      {
+         lastSlew.stallChecks++;
+         motorState = status;
+         if (status == MotorStatus::Stalled)
+            friction.stalled(angle, duty, params.maxDuty);
+         else if (status == MotorStatus::OK)
+            friction.moved(angle, periodMaxDuty, params.minDuty);
+         periodMaxDuty = 0;
+      }
       if (status == MotorStatus::Stalled)
       {
          if (initialStallsPermitted > 0)
          {
             int destallTry = params.destallTries - initialStallsPermitted + 1;
-            std::cerr << "\nInitial stall detected. Performing a de-stall maneuver "
-                      << destallTry << "/" << params.destallTries << ".\n";
-            motor->setPWM(params.destallDuty);
-            std::this_thread::sleep_for(params.destallDuration);
-            motor->setPWM(duty);
+            asyncOutput().message(stderr,
+               "\nInitial stall detected. Performing a de-stall maneuver %d/%d.\n",
+               destallTry, (int)params.destallTries);
+            TRACE_SPAN("destall");
+            lastSlew.destalls++;
+
+            // The de-stall pulse goes as far above the local minimum duty as
+            // the configured one goes above the global one.
+            float destallDuty = params.destallDuty +
+               friction.minDuty(angle, params.minDuty) - params.minDuty;
+            setDuty(std::min<float>(std::max<float>(destallDuty, params.destallDuty),
+                                    params.maxDuty), minDuty);
+            auto destallEnd = std::chrono::steady_clock::now() + params.destallDuration;
+            EventLoop::Event event;
+            while ((event = events.wait(destallEnd)) == EventLoop::Event::Tick)
+               if (watchdog)
+                  watchdog->heartbeat();
+            if (event == EventLoop::Event::Error)
+               ticking = false;
+            setDuty(duty, minDuty);
             initialStallsPermitted--;
          }
          else
          {
-            std::cerr << "\nStall detected!";
+            asyncOutput().message(stderr, "\nStall detected!");
             retval = ReturnValue::Stall;
+            fault = Fault::Stall;
             break;
          }
       }
       else if (status == MotorStatus::WrongDirection)
       {
-         std::cerr << "\nMotor turning in wrong direction!";
+         asyncOutput().message(stderr, "\nMotor turning in wrong direction!");
          retval = ReturnValue::HardwareError;
+         fault = Fault::WrongDirection;
          break;
       }
       else if (status == MotorStatus::OK)
@@ -414,50 +911,552 @@ ReturnValue Controller::slew(CookedAngle targetAngle)
       }
 
       // Check if the user's panic level has increased recently.
-      if (timesInterrupted > interruptsHandled )
+      if (!interruptHandled && interruptCount(signalBaseline) > 0)
       {
-         interruptsHandled = timesInterrupted;
-         if (interruptsHandled == 1)
-         {
-            std::cerr << "\nInterrupted, stopping gracefully. Give Ctrl+C again for immediate stop.\n";
-            retval = ReturnValue::SlewNotFinished;
-
-            // Determine the closest target angle that we can reach by slowly
-            // decelerating.
-            if (phase == SlewPhase::accelerating)
-               targetAngle = angle + direction * diffInitial;
-            else if (phase == SlewPhase::plateau)
-               targetAngle = angle + direction * params.accelAngle;
-            // else if (phase == SlewPhase::decelerating)
-            //    Already decelerating - nothing to do.
-
-            // From now on, the progress bar shows the progress of stopping.
-            progressIndicator->reset(angle, targetAngle);
-         }
-         else
+         interruptHandled = true;
+         asyncOutput().message(stderr, handleSignals ?
+            "\nInterrupted, stopping gracefully. Give Ctrl+C again for immediate stop.\n" :
+            "\nInterrupted, stopping gracefully.\n");
+         retval = ReturnValue::SlewNotFinished;
+         fault = Fault::Interrupted;
+
+         // Determine the closest target angle that we can reach by slowly
+         // decelerating.
+         if (phase == SlewPhase::accelerating)
+            targetAngle = angle + direction * diffInitial;
+         else if (phase == SlewPhase::plateau)
+            targetAngle = angle + direction * params.accelAngle;
+         // else if (phase == SlewPhase::decelerating)
+         //    Already decelerating - nothing to do.
+
+         // From now on, the progress bar shows the progress of stopping.
+         progressIndicator->reset(angle, targetAngle);
+      }
+
+      // Pick the loop rate and the number of readouts for the next
+      // measurement. Precision barely matters on the plateau, but it is
+      // everything on the final approach.
+      std::chrono::milliseconds period;
+      if (phase == SlewPhase::plateau)
+      {
+         period = params.plateauLoopDelay;
+         readouts = params.minReadouts;
+      }
+      else if (diffTarget - params.tolerance < params.approachAngle)
+      {
+         period = params.approachLoopDelay;
+         readouts = noise.readoutsFor(params.tolerance / 3,
+                                      params.minReadouts, params.maxReadouts);
+      }
+      else
+      {
+         period = params.loopDelay;
+         readouts = noise.readoutsFor(params.tolerance,
+                                      params.minReadouts, params.maxReadouts);
+      }
+      if (period != tickPeriod)
+      {
+         tickPeriod = period;
+         ticking = events.startTicks(tickPeriod);
+      }
+
+      publishStatus(angle, phase, duty, motorState, fault);
+      lastSlew.peakVelocity = std::max(lastSlew.peakVelocity, std::abs(statusVelocity));
+
+      if (statistics && statisticsReportRequested())
+         statistics->post(asyncOutput(), stderr);
+
+      // Wait for the next tick (unless an emergency stop is pending already).
+      StageTimer delayTimer(statistics, &SlewStatistics::loopDelay);
+      TRACE_SPAN("loop delay");
+      if (ticking && interruptCount(signalBaseline) <= 1)
+      {
+         EventLoop::Event event = events.wait();
+         if (event == EventLoop::Event::Error)
+            ticking = false;
+         else if (event == EventLoop::Event::Tick && statistics)
          {
-            std::cerr << "\nEmergency stop. Hold on to your gears!";
-            retval = ReturnValue::SlewNotFinished;
-            break;
+            statistics->tickLateness.record(events.tickLateness());
+            statistics->missedTicks += events.missedTicks();
          }
       }
-      std::this_thread::sleep_for(params.loopDelay);
    }
    progressIndicator->finalize();
-   delete progressIndicator;
 
    // De-energize the motor and turn off the H-bridge switches.
-   motor->setPWM(0);
-   motor->turnOff();
-   signal(SIGINT, SIG_DFL);
+   disengage();
+   if (watchdog)
+      watchdog->disarm();
+   events.stopTicks();
+   if (catchSignals)
+      events.releaseSignals();
+   publishStatus(angle, SlewPhase::idle, 0, motorState, fault);
+   std::chrono::duration<float> duration = std::chrono::steady_clock::now() - slewStart;
+   lastSlew.duration = duration.count();
+   lastSlew.finalAngle = angle.val;
+   lastSlew.finalError = std::abs(lastSlew.targetAngle - angle.val);
+   lastSlew.result = (uint8_t)retval;
+   if (statistics)
+   {
+      statistics->sensorNoise = noise.sigma();
+      statistics->spikeRate = noise.spikeRate();
+   }
+
+   // Only now that the motor is safely off, wait for the output to catch up.
+   asyncOutput().flush();
+   return retval;
+}
+
+
+template <class MotorType, class SensorType>
+ReturnValue BasicController<MotorType, SensorType>::calibrationSweep(
+   Sensor& reference, HarmonicFit& fit, ResidualStats& residuals)
+{
+   // Go to one end of the safe range first.
+   ReturnValue retval = slew(CookedAngle::getMinimum());
+   if (retval != ReturnValue::Success)
+      return retval;
+
+   std::cout << "Calibration sweep: collecting samples.\n";
+   retval = sweep(reference, CookedAngle::getMaximum(),
+      [&fit](RawAngle raw, degrees ref) { fit.addSample(raw, ref); });
+   if (retval != ReturnValue::Success)
+      return retval;
+
+   if (!fit.solve())
+   {
+      std::cerr << "The collected samples do not determine the coefficients.\n";
+      return ReturnValue::CalibrationError;
+   }
+
+   std::cout << "Calibration sweep: checking the fit.\n";
+   return sweep(reference, CookedAngle::getMinimum(),
+      [&fit, &residuals](RawAngle raw, degrees ref)
+         { residuals.add(fit.residual(raw, ref)); });
+}
+
+
+/* Moves the axis towards endAngle at the minimum duty cycle and passes the
+ * (raw, reference) pairs obtained on the way to the process function.
+*/
+template <class MotorType, class SensorType>
+ReturnValue BasicController<MotorType, SensorType>::sweep(
+   Sensor& reference, CookedAngle endAngle,
+   std::function<void(RawAngle, degrees)> process)
+{
+   ReturnValue retval = ReturnValue::Success;
+   const unsigned int numberOfReadouts = 5;
+   int signalBaseline = events.signalCount();
+   int interruptsHandled = interruptCount(signalBaseline);
+   if (handleSignals && !events.catchSignals())
+   {
+      perror("signalfd");
+      return ReturnValue::HardwareError;
+   }
+
+   CookedAngle initialAngle = getCookedAngle();
+   float direction = (endAngle.val > initialAngle.val ? 1.0 : -1.0);
+   engage(direction);
+   if (watchdog)
+      watchdog->arm(direction);
+
+   asyncOutput().start();
+   BarIndicator progressIndicator(initialAngle, endAngle);
+   beginMotorMonitoring(initialAngle);
+   float sweepDuty = friction.minDuty(initialAngle, params.minDuty);
+   setDuty(sweepDuty, sweepDuty);
+
+   bool ticking = events.startTicks(params.loopDelay);
+   while (true)
+   {
+      if (!ticking)
+      {
+         asyncOutput().message(stderr, "\nThe loop timer failed!");
+         retval = ReturnValue::HardwareError;
+         break;
+      }
+
+      // Take a few readout pairs and keep the one with the median deviation.
+      // Unlike in getCookedAngle(), the deviation is the quantity to filter
+      // on, since it stays small and smooth even across the raw zero.
+      RawAngle raws[numberOfReadouts] = {
+         RawAngle(0), RawAngle(0), RawAngle(0), RawAngle(0), RawAngle(0) };
+      degrees refs[numberOfReadouts];
+      degrees deviations[numberOfReadouts];
+      unsigned int order[numberOfReadouts];
+      if (watchdog)
+         watchdog->heartbeat();
+      for (unsigned int i = 0; i < numberOfReadouts; i++)
+      {
+         auto lock = lockHardware();
+         raws[i] = sensor.getRawAngle();
+         refs[i] = reference.getRawAngle().val;
+         deviations[i] = mod360(raws[i].val - refs[i] + 180.0);
+         order[i] = i;
+      }
+      std::sort(order, order + numberOfReadouts,
+         [&deviations](unsigned int a, unsigned int b)
+            { return deviations[a] < deviations[b]; });
+      unsigned int median = order[numberOfReadouts / 2];
+      process(raws[median], refs[median]);
+
+      CookedAngle angle(raws[median]);
+      progressIndicator.print(angle);
+      if (direction * (endAngle - angle) < params.tolerance)
+      {
+         progressIndicator.print(angle, true);
+         break;
+      }
+
+      // Sweep at the lowest duty that keeps the axis moving here.
+      float duty = friction.minDuty(angle, params.minDuty);
+      setDuty(duty, duty);
+
+      MotorStatus status = checkMotor(angle, direction);
+      if (status == MotorStatus::Stalled)
+      {
+         friction.stalled(angle, duty, params.maxDuty);
+         asyncOutput().message(stderr, "\nStall detected!");
+         retval = ReturnValue::Stall;
+         break;
+      }
+      else if (status == MotorStatus::WrongDirection)
+      {
+         asyncOutput().message(stderr, "\nMotor turning in wrong direction!");
+         retval = ReturnValue::HardwareError;
+         break;
+      }
+
+      if (interruptCount(signalBaseline) > interruptsHandled)
+      {
+         asyncOutput().message(stderr, "\nInterrupted, calibration aborted.");
+         retval = ReturnValue::SlewNotFinished;
+         break;
+      }
+      if (safetyTripped())
+      {
+         retval = ReturnValue::SafetyTrip;
+         break;
+      }
+      if (events.wait() == EventLoop::Event::Error)
+         ticking = false;
+   }
+   progressIndicator.finalize();
+
+   disengage();
+   if (watchdog)
+      watchdog->disarm();
+   events.stopTicks();
+   if (handleSignals)
+      events.releaseSignals();
+   asyncOutput().flush();
+   saveFrictionMap();
    return retval;
 }
 
 
+template <class MotorType, class SensorType>
+ReturnValue BasicController<MotorType, SensorType>::identify(MotorModel& model)
+{
+   if (safetyTripped())
+   {
+      fprintf(stderr, "The watchdog has tripped (%s); not moving.\n",
+              Watchdog::describe(watchdog->reason()));
+      return ReturnValue::SafetyTrip;
+   }
+   if (slewInProgress.exchange(true))
+   {
+      fprintf(stderr, "Another slew is in progress.\n");
+      return ReturnValue::SlewNotFinished;
+   }
+   interruptRequests = 0;
+
+   // Experiment timing; the steps assume that the time constant is well
+   // below half of the step duration.
+   const auto rampStep = std::chrono::milliseconds(200);
+   const auto probeDuration = std::chrono::milliseconds(1000);
+   const auto settleTime = std::chrono::milliseconds(1000);
+   const auto stepDuration = std::chrono::milliseconds(2000);
+   const unsigned int numberOfSteps = 5;
+   const degrees breakawayAngle = 0.2;
+   const degrees limitMargin = 2.0;
+
+   ReturnValue retval = ReturnValue::Success;
+   int signalBaseline = events.signalCount();
+   if (handleSignals && !events.catchSignals())
+   {
+      perror("signalfd");
+      return ReturnValue::HardwareError;
+   }
+
+   CookedAngle initialAngle = getCookedAngle();
+   float direction = (CookedAngle::getMaximum() - initialAngle >
+                      initialAngle - CookedAngle::getMinimum() ? 1.0 : -1.0);
+   CookedAngle limit = (direction > 0 ? CookedAngle::getMaximum() - limitMargin
+                                      : CookedAngle::getMinimum() + limitMargin);
+   engage(direction);
+   if (watchdog)
+      watchdog->arm(direction);
+   bool ticking = events.startTicks(params.loopDelay);
+
+   // Positions along the direction of travel, with the times in seconds
+   // from the start of the current experiment.
+   struct Sample { double time; degrees position; };
+   std::vector<Sample> samples;
+   auto experimentStart = std::chrono::steady_clock::now();
+   bool limitReached = false;
+   degrees position = 0;
+
+   // Keep the duty for the given time, recording the positions.
+   auto hold = [&](unsigned short duty, std::chrono::milliseconds duration)
+      {
+         setDuty(duty);
+         auto end = std::chrono::steady_clock::now() + duration;
+         while (std::chrono::steady_clock::now() < end)
+         {
+            if (!ticking)
+            {
+               std::cerr << "The loop timer failed, identification aborted.\n";
+               return ReturnValue::HardwareError;
+            }
+            if (interruptCount(signalBaseline) > 0)
+            {
+               std::cerr << "Interrupted, identification aborted.\n";
+               return ReturnValue::SlewNotFinished;
+            }
+            if (safetyTripped())
+               return ReturnValue::SafetyTrip;
+            if (watchdog)
+               watchdog->heartbeat();
+
+            CookedAngle angle = measureAngle(params.maxReadouts);
+            std::chrono::duration<double> time =
+               std::chrono::steady_clock::now() - experimentStart;
+            position = direction * (angle - initialAngle);
+            samples.push_back({time.count(), position});
+            if (direction * (limit - angle) < 0)
+            {
+               limitReached = true;
+               break;
+            }
+            if (events.wait() == EventLoop::Event::Error)
+               ticking = false;
+         }
+         return ReturnValue::Success;
+      };
+
+   std::cout << "Identification: looking for the breakaway duty cycle.\n";
+   unsigned short breakawayDuty = 0;
+   for (unsigned short duty = 1; duty <= params.maxDuty; duty++)
+   {
+      retval = hold(duty, rampStep);
+      if (retval != ReturnValue::Success || limitReached)
+         break;
+      if (position > breakawayAngle)
+      {
+         breakawayDuty = duty;
+         break;
+      }
+   }
+   if (retval == ReturnValue::Success && !breakawayDuty)
+   {
+      std::cerr << "The axis did not move even at the maximum duty cycle.\n";
+      retval = ReturnValue::CalibrationError;
+   }
+
+   // The ramp notices the motion only after a while; probe the last few
+   // duty cycles from standstill, for longer.
+   if (retval == ReturnValue::Success)
+      retval = hold(0, settleTime);
+   for (unsigned short duty = std::max(breakawayDuty - 2, 1);
+        retval == ReturnValue::Success && !limitReached && duty < breakawayDuty;
+        duty++)
+   {
+      degrees probeStart = position;
+      retval = hold(duty, probeDuration);
+      if (position - probeStart > breakawayAngle)
+         breakawayDuty = duty;
+   }
+
+   MotorModel result;
+   result.breakawayDuty = breakawayDuty;
+   for (unsigned int step = 0;
+        retval == ReturnValue::Success && step < numberOfSteps; step++)
+   {
+      unsigned short duty = breakawayDuty + round(
+         float(params.maxDuty - breakawayDuty) * step / (numberOfSteps - 1));
+      if (!result.points.empty() && duty == result.points.back().duty)
+         continue;
+
+      // Come to a standstill first, then step up to the duty cycle.
+      samples.clear();
+      retval = hold(0, settleTime);
+      if (retval != ReturnValue::Success || limitReached)
+         break;
+      degrees restPosition = position;
+
+      samples.clear();
+      experimentStart = std::chrono::steady_clock::now();
+      retval = hold(duty, stepDuration);
+      if (retval != ReturnValue::Success || limitReached)
+         break;
+
+      // Once the transient is over, the position of a first-order system
+      // grows as v * (t - tau): fit a line to the second half of the step.
+      double half = std::chrono::duration<double>(stepDuration).count() / 2;
+      double n = 0, st = 0, sx = 0, stt = 0, stx = 0;
+      for (const Sample& sample : samples)
+         if (sample.time >= half)
+         {
+            n++;
+            st += sample.time;
+            sx += sample.position;
+            stt += sample.time * sample.time;
+            stx += sample.time * sample.position;
+         }
+      if (n < 3)
+         continue;
+      double velocity = (n * stx - st * sx) / (n * stt - st * st);
+      double intercept = (sx - velocity * st) / n;
+      double timeConstant = 0;
+      if (velocity > 0)
+         timeConstant = std::min(std::max((restPosition - intercept) / velocity, 0.0), half);
+
+      result.points.push_back({float(duty), float(std::max(velocity, 0.0)),
+                               float(timeConstant)});
+      std::cout << "Identification: duty " << duty << " %: "
+                << result.points.back().velocity << " degrees/s, time constant "
+                << result.points.back().timeConstant << " s\n";
+   }
+   if (limitReached)
+      std::cerr << "Reached the end of the safe range.\n";
+
+   setDuty(0);
+   disengage();
+   if (watchdog)
+      watchdog->disarm();
+   events.stopTicks();
+   if (handleSignals)
+      events.releaseSignals();
+   slewInProgress = false;
+
+   if (retval != ReturnValue::Success)
+      return retval;
+   result.makeMonotonic();
+   if (!result.valid())
+   {
+      std::cerr << "Too few steps to determine the model.\n";
+      return ReturnValue::CalibrationError;
+   }
+   model = result;
+   return ReturnValue::Success;
+}
+
+
+/* The duty cycle that the motor model calls for at the given distance from
+ * the start (when accelerating) or from the stop point (when decelerating).
+ * The velocity profile rises linearly from the velocity at the lowest duty
+ * to the one at maxDuty over accelAngle. To make up for the lag of the
+ * motor, the duty is chosen for the velocity that the profile will call
+ * for one time constant later.
+*/
+template <class MotorType, class SensorType>
+float BasicController<MotorType, SensorType>::feedforwardDuty(
+   degrees distance, bool accelerating, float minDuty) const
+{
+   const MotorModel& model = params.model;
+   float lowDuty = std::max<float>(minDuty, model.breakawayDuty);
+   float lowVelocity = model.velocityAt(lowDuty);
+   float highVelocity = model.velocityAt(params.maxDuty);
+   float slope = (highVelocity - lowVelocity) / params.accelAngle;
+
+   float velocity = lowVelocity + std::max<degrees>(distance, 0) * slope;
+   float acceleration = (accelerating ? 1 : -1) * slope * velocity;
+   velocity += model.timeConstantAt(model.dutyFor(velocity)) * acceleration;
+   velocity = std::min(std::max(velocity, lowVelocity), highVelocity);
+   return std::min<float>(std::max(model.dutyFor(velocity), lowDuty),
+                          params.maxDuty);
+}
+
+
+/* Keeps the friction map file up to date (outside of the control loop, as
+ * this allocates memory and blocks).
+*/
+template <class MotorType, class SensorType>
+void BasicController<MotorType, SensorType>::saveFrictionMap()
+{
+   if (!friction.changed() || params.frictionFile.empty())
+      return;
+   if (!friction.save(params.frictionFile.c_str()))
+   {
+      fprintf(stderr, "warning: could not save the friction map: ");
+      perror(params.frictionFile.c_str());
+   }
+   params.friction = friction;
+}
+
+
+template <class MotorType, class SensorType>
+void BasicController<MotorType, SensorType>::saveHistory()
+{
+   if (!lastSlew.time)
+      return;
+   estimator.add(lastSlew);
+   if (params.historyFile.empty())
+      return;
+   if (!appendSlewRecord(params.historyFile.c_str(), lastSlew))
+   {
+      fprintf(stderr, "warning: could not record the slew: ");
+      perror(params.historyFile.c_str());
+   }
+}
+
+
+/* Makes a snapshot of the controller state for currentStatus() and the
+ * status subscribers.
+*/
+template <class MotorType, class SensorType>
+void BasicController<MotorType, SensorType>::publishStatus(
+   CookedAngle angle, SlewPhase phase, float duty, MotorStatus motorStatus,
+   Fault fault)
+{
+   // The velocity is smoothed over a fraction of a second, since the sensor
+   // noise would otherwise swamp it at the loop rate.
+   const float smoothingTime = 0.25;
+   auto now = std::chrono::steady_clock::now();
+   float elapsed = std::chrono::duration<float>(now - statusTime).count();
+   if (elapsed > 0)
+   {
+      float velocity = (angle - statusAngle) / elapsed;
+      statusVelocity += (velocity - statusVelocity) * elapsed / (smoothingTime + elapsed);
+   }
+   statusAngle = angle;
+   statusTime = now;
+
+   StatusSnapshot status;
+   status.tick = ++statusTick;
+   status.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+   status.userAngle = UserAngle(angle).val;
+   status.cookedAngle = angle.val;
+   status.rawAngle = lastRawCode.toDegrees();
+   status.velocity = statusVelocity;
+   status.duty = duty;
+   status.phase = phase;
+   status.motorStatus = motorStatus;
+   status.fault = fault;
+   latestStatus.store(status);
+   if (statusPublisher)
+      statusPublisher->publish(status);
+}
+
+
 /* Records the current angle and the timestamp. This will later be used to tell
  * if the motor is spinning or not.
 */
-void Controller::beginMotorMonitoring(const CookedAngle currentAngle)
+template <class MotorType, class SensorType>
+void BasicController<MotorType, SensorType>::beginMotorMonitoring(
+   const CookedAngle currentAngle)
 {
    stallCheckAngle = currentAngle;
    stallCheckTime = std::chrono::steady_clock::now();
@@ -468,9 +1467,11 @@ void Controller::beginMotorMonitoring(const CookedAngle currentAngle)
  * to go. If not, determines whether the motor is not moving at all or it is
  * spinning in the wrong direction.
 */
-Controller::MotorStatus Controller::checkMotor(const CookedAngle currentAngle,
-                                               const float wantedDirection)
+template <class MotorType, class SensorType>
+auto BasicController<MotorType, SensorType>::checkMotor(
+   const CookedAngle currentAngle, const float wantedDirection) -> MotorStatus
 {
+   TRACE_SPAN("checkMotor");
    MotorStatus status = MotorStatus::Undetermined;
 
    auto currentTime = std::chrono::steady_clock::now();
@@ -496,3 +1497,9 @@ Controller::MotorStatus Controller::checkMotor(const CookedAngle currentAngle,
    }
    return status;
 }
+
+
+// The controller is instantiated for the backend of this build and for the
+// abstract interfaces (which can be used with any backend).
+template class BasicController<BackendMotor, BackendSensor>;
+template class BasicController<Motor, Sensor>;
@@ -21,10 +21,33 @@
 #ifndef CONTROLLER_H
 #define CONTROLLER_H
 
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include "angles.h"
+#include "bridge.h"
+#include "calibration.h"
+#include "estimate.h"
+#include "eventloop.h"
+#include "friction.h"
+#include "history.h"
 #include "interface.h"
+#include "model.h"
+#include "noise.h"
+#include "stats.h"
+#include "status.h"
+#include "watchdog.h"
+
+#ifdef HARDWARE
+   #include "hardware.h"
+#else
+   #include "simulated.h"
+#endif
 
 class ConfigFileException : public std::exception
 {
@@ -34,6 +57,14 @@ public:
    const std::string message;
 };
 
+class HardwareException : public std::exception
+{
+public:
+   HardwareException(const std::string& what) : message(what) {}
+   inline const char* what() { return message.c_str(); }
+   const std::string message;
+};
+
 /* Parameters that affect the operation of the controller. Runtime values of
  * these parameters will be read from the configuration file (all of them are
  * required to be explicitly set there).
@@ -52,52 +83,318 @@ struct ControllerParams
    unsigned short destallDuty = 0;
    std::chrono::milliseconds destallDuration{0};
    unsigned short destallTries = 0;
+   unsigned int pwmRange = 100;
+   unsigned int pwmFrequency = 12000;
+
+   // H-bridge dead times (see BridgeSequencer)
+   BridgeTiming bridge;
+
+   // motor model (see MotorModel), read from modelFile if it exists
+   std::string modelFile;
+   MotorModel model;
+
+   // learned minimum duties (see FrictionMap), kept in frictionFile
+   std::string frictionFile;
+   FrictionMap friction;
+
+   // every slew appends a SlewRecord to historyFile (if set)
+   std::string historyFile;
 
    // movement parameters
    CookedAngle parkPosition = CookedAngle(0);
    degrees accelAngle = 20.0;
    degrees tolerance = 0.1;
 
-   // control loop parameters
+   // control loop parameters: the loop runs every loopDelay, except on the
+   // plateau and on the final approach (within approachAngle of the
+   // tolerance band); the number of sensor readouts per measurement adapts
+   // to the sensor noise within [minReadouts:maxReadouts]
    std::chrono::milliseconds loopDelay{10};
-   enum class IndicatorStyle { Bar, Percent } indicatorStyle = IndicatorStyle::Bar;
+   std::chrono::milliseconds plateauLoopDelay{20};
+   std::chrono::milliseconds approachLoopDelay{5};
+   degrees approachAngle = 1.0;
+   unsigned short minReadouts = 3;
+   unsigned short maxReadouts = 9;
+   enum class IndicatorStyle { Bar, Percent, None } indicatorStyle = IndicatorStyle::Bar;
+
+   // safety watchdog parameters
+   WatchdogParams watchdog;
+
+   // the angle scales (see AngleScales); reading the parameters from a file
+   // leaves the ones in effect alone
+   AngleScales angleScales;
 };
 
+// Read the parameters from a configuration file. All errors are reported
+// as ConfigFileException.
+ControllerParams readControllerParams(const char* filename);
+
+// The same, but also put the angle scales of the file in effect (if the
+// file could be read).
+ControllerParams loadControllerParams(const char* filename);
+
 enum class ReturnValue
 {
   Success = 0,
   ConfigError = 1,
   HardwareError = 2,
   Stall = 3,
-  SlewNotFinished = 4
+  SlewNotFinished = 4,
+  CalibrationError = 5,
+  SafetyTrip = 6
 };
 
-class Controller
+/* A slew running in the background (see BasicController::slewAsync()).
+ *
+ * The callbacks are called from a thread of the handle (never from the
+ * control loop): the progress callback with the latest status at a regular
+ * interval and once more with the final status, and then the completion
+ * callback with the outcome. Destroying the handle waits for the slew to
+ * finish.
+*/
+class SlewHandle
 {
 public:
-   Controller(ControllerParams initialParams);
+   enum class Cancel { Graceful, Immediate };
+   typedef std::function<void(const StatusSnapshot&)> ProgressCallback;
+   typedef std::function<void(ReturnValue)> CompletionCallback;
+
+   ~SlewHandle();
+
+   // Wait until the slew (and the completion callback) has finished and
+   // return the outcome.
+   ReturnValue wait();
+
+   // Returns true if the slew has finished, storing the outcome in result
+   // (if given).
+   bool poll(ReturnValue* result = nullptr) const;
+
+   // The latest status of the controller.
+   inline StatusSnapshot status() const { return statusFunction(); }
+
+   // Stop the slew: gracefully, decelerating as usual (the first Ctrl+C of
+   // the mcontrol program), or immediately (the second one). Returns right
+   // away; use wait() to wait for the axis to stop.
+   void cancel(Cancel mode = Cancel::Graceful);
+
+private:
+   template <class MotorType, class SensorType> friend class BasicController;
+
+   SlewHandle(std::function<void()> interrupt,
+              std::function<StatusSnapshot()> status);
+   void start(std::function<ReturnValue()> run, ProgressCallback progress,
+              CompletionCallback completion,
+              std::chrono::milliseconds progressPeriod);
+   void notify(ProgressCallback progress, CompletionCallback completion,
+               std::chrono::milliseconds progressPeriod, uint64_t initialTick);
+
+   std::function<void()> interruptFunction;
+   std::function<StatusSnapshot()> statusFunction;
+   std::thread slewThread;
+   std::thread notifierThread;
+   mutable std::mutex mutex;
+   std::condition_variable condition;
+   bool slewDone = false;
+   bool finished = false;
+   ReturnValue result = ReturnValue::Success;
+};
+
+
+/* The controller core.
+ *
+ * It is parameterized with the motor and sensor types, so that when it is
+ * given the concrete (final) backend classes, the calls to the hardware in
+ * the control loop are resolved at compile time and can be inlined.
+ * BasicController<Motor, Sensor> accepts any backend through the abstract
+ * interfaces, at the cost of a virtual call for every hardware access.
+*/
+template <class MotorType, class SensorType>
+class BasicController
+{
+public:
+   BasicController(const ControllerParams& initialParams,
+                   MotorType& motor_, SensorType& sensor_);
 
    // Methods for getting the current angle in various flavors.
    RawAngle getRawAngle() const;
    CookedAngle getCookedAngle() const;
    UserAngle getUserAngle() const;
 
+   // The raw angle behind the most recent getCookedAngle() result (i.e.,
+   // after the filtering of the readouts).
+   inline RawAngle getLastRawAngle() const { return RawAngle(lastRawCode); }
+
+   // Replace the parameters (not during a slew).
+   void setParams(const ControllerParams& newParams);
+   inline const ControllerParams& getParams() const { return params; }
+
    // This is what it's all about.
    ReturnValue slew(CookedAngle targetAngle);
 
-private:
-   enum class MotorStatus { Undetermined, OK, Stalled, WrongDirection };
+   // Predict how long a slew between the given angles takes, from the
+   // motor model and the slew history (see SlewEstimator), without touching
+   // the hardware. Can be called at any time, even during a slew, and is
+   // cheap enough to go through many candidate targets. Returns false if
+   // there is neither a model nor any history to go by.
+   inline bool estimateSlew(CookedAngle from, CookedAngle to,
+                            SlewEstimate& estimate) const
+      { return estimator.estimate(to - from, estimate); }
+
+   // Start a slew in a thread of its own and return a handle to it right
+   // away. Returns null if a slew is in progress already. The slew does not
+   // react to signals and has no progress indicator; use the callbacks
+   // instead. The controller must outlive the handle.
+   std::unique_ptr<SlewHandle> slewAsync(
+      CookedAngle targetAngle,
+      SlewHandle::ProgressCallback progress = nullptr,
+      SlewHandle::CompletionCallback completion = nullptr,
+      std::chrono::milliseconds progressPeriod = std::chrono::milliseconds(100));
 
+   // The state of the controller at the latest tick of the control loop.
+   inline StatusSnapshot currentStatus() const { return latestStatus.load(); }
+
+   // Interrupt the slew in progress from another thread, the same way as
+   // Ctrl+C does: the first interruption stops the slew gracefully, the
+   // second one immediately.
+   void interrupt();
+
+   // Whether slews also react to SIGINT (as an interruption) and SIGTERM (as
+   // an emergency stop); enabled by default. Programs that embed the
+   // controller will usually want to handle signals themselves.
+   void setSignalHandling(bool enable);
+
+   // Let the given watchdog watch over the slews (null for none). Once it
+   // trips, no slews are possible until resetSafetyTrip() is called.
+   void setWatchdog(Watchdog* watchdog_);
+   void resetSafetyTrip();
+
+   // Record the latencies of the control loop stages into the given
+   // statistics (null turns the recording off).
+   void setStatistics(SlewStatistics* statistics_);
+
+   // Publish the state of the controller at every tick of the control loop
+   // (null turns the publishing off).
+   void setStatusPublisher(StatusPublisher* publisher);
+
+   // Slowly sweep the axis over the whole safe range and back, pairing the
+   // sensor readouts with those of a reference sensor (a second encoder). The
+   // pairs from the forward sweep are fed into the fit and the pairs from the
+   // return sweep are used to check the result.
+   ReturnValue calibrationSweep(Sensor& reference, HarmonicFit& fit,
+                                ResidualStats& residuals);
+
+   // Determine the motor model: a slow ramp of the duty cycle finds where
+   // the axis breaks away, and steps to several duty cycles between there
+   // and maxDuty measure the steady velocities and the time constants. The
+   // axis moves towards the farther end of the safe range (by some 20
+   // degrees).
+   ReturnValue identify(MotorModel& model);
+
+private:
+   ReturnValue runSlew(CookedAngle targetAngle, bool background);
+   CookedAngle measureAngle(unsigned int numberOfReadouts) const;
    void beginMotorMonitoring(const CookedAngle currentAngle);
    MotorStatus checkMotor(const CookedAngle currentAngle,
                           const float wantedDirection);
+   ReturnValue sweep(Sensor& reference, CookedAngle endAngle,
+                     std::function<void(RawAngle, degrees)> process);
+   float feedforwardDuty(degrees distance, bool accelerating,
+                         float minDuty) const;
+   void saveFrictionMap();
+   void saveHistory();
+   void publishStatus(CookedAngle angle, SlewPhase phase, float duty,
+                      MotorStatus motorStatus, Fault fault);
+   int interruptCount(int signalBaseline) const;
+
+   std::unique_lock<PriorityInheritanceMutex> lockHardware() const;
+   inline bool safetyTripped() const { return watchdog && watchdog->tripped(); }
+   inline void setDuty(float duty, float minDuty = 0)
+      { bridge.setDuty(duty, minDuty); }
+   inline void engage(float direction) { bridge.engage(direction); }
+   inline void disengage() { bridge.release(); }
 
    ControllerParams params;
-   Motor* motor;
-   Sensor* sensor;
+   MotorType& motor;
+   SensorType& sensor;
+   BridgeSequencer<MotorType> bridge;
 
    CookedAngle stallCheckAngle{0};
    std::chrono::steady_clock::time_point stallCheckTime;
+
+   SlewStatistics* statistics = nullptr;
+
+   StatusPublisher* statusPublisher = nullptr;
+   SeqLock<StatusSnapshot> latestStatus;
+   uint64_t statusTick = 0;
+   CookedAngle statusAngle{0};
+   float statusVelocity = 0;
+   std::chrono::steady_clock::time_point statusTime;
+
+   // The raw readout behind the latest filtered angle.
+   mutable RawCode lastRawCode{0};
+
+   // Sensor noise, as seen by the angle measurements.
+   mutable SensorNoise noise;
+
+   // The minimum duties learned so far.
+   FrictionMap friction;
+
+   // The summary of the latest slew (time is zero if it never started).
+   SlewRecord lastSlew;
+
+   // Predicts the slews from the model and the history.
+   SlewEstimator estimator;
+
+   std::atomic_int interruptRequests;
+   std::atomic_bool slewInProgress{false};
+   bool handleSignals = true;
+   EventLoop events;
+   Watchdog* watchdog = nullptr;
+};
+
+
+/* The hardware (or the simulator) that this build of mcontrol controls. */
+#ifdef HARDWARE
+typedef HardwareMotor BackendMotor;
+typedef HardwareSensor BackendSensor;
+#else
+typedef SimulatedMotor BackendMotor;
+typedef SimulatedSensor BackendSensor;
+#endif
+
+struct ControllerBackend
+{
+   ControllerBackend();
+
+   // Create a sensor to serve as a reference in calibrations. Returns null
+   // if the sensor could not be set up.
+   std::unique_ptr<BackendSensor> createReferenceSensor();
+
+   // Hardware initialization that must precede the creation of the motor
+   // and the sensor. Always returns zero (failures terminate the program).
+   static int initialize();
+
+   int initialized;
+   BackendMotor motor;
+   BackendSensor sensor;
+};
+
+
+/* The controller for the backend selected at compile time. */
+class Controller : private ControllerBackend,
+                   public BasicController<BackendMotor, BackendSensor>
+{
+public:
+   Controller(const ControllerParams& initialParams);
+
+   using BasicController<BackendMotor, BackendSensor>::calibrationSweep;
+   ReturnValue calibrationSweep(HarmonicFit& fit, ResidualStats& residuals);
+
+   // Replace the parameters (not during a slew), including the PWM setup.
+   void setParams(const ControllerParams& newParams);
+
+private:
+   Watchdog watchdog;
 };
 
 #endif // CONTROLLER_H
@@ -0,0 +1,96 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "as5048a.h"
+
+bool AS5048A::evenParity(uint16_t frame)
+{
+   frame ^= frame >> 8;
+   frame ^= frame >> 4;
+   frame ^= frame >> 2;
+   frame ^= frame >> 1;
+   return !(frame & 1);
+}
+
+
+uint16_t AS5048A::reply(uint16_t data) const
+{
+   uint16_t frame = (data & 0x3fff) | (errors ? 0x4000 : 0);
+   if (!evenParity(frame))
+      frame |= 0x8000;
+   return frame;
+}
+
+
+uint16_t AS5048A::transfer(uint16_t command)
+{
+   uint16_t answer = pending;
+
+   if (!evenParity(command))
+   {
+      errors |= parityError;
+      pending = reply(0);
+      return answer;
+   }
+
+   bool read = command & 0x4000;
+   uint16_t address = command & 0x3fff;
+   uint16_t data = 0;
+   if (address == nop)
+      data = 0;
+   else if (!read)
+      errors |= commandInvalid;
+   else
+   {
+      switch (address)
+      {
+         case clearErrorFlag:
+            data = errors;
+            errors = 0;
+            break;
+         case zeroPositionHigh:
+         case zeroPositionLow:
+            data = 0;
+            break;
+         case diagnostics:
+            // Offset compensation finished, AGC in the middle of its range.
+            data = 0x0100 | 0x80;
+            break;
+         case magnitude:
+            data = 0x1000;
+            break;
+         case angle:
+            data = magnet.getRawCode().val;
+            break;
+         default:
+            errors |= commandInvalid;
+      }
+   }
+
+   pending = reply(data);
+   return answer;
+}
+
+
+void AS5048A::framingFault()
+{
+   errors |= framingError;
+   pending = reply(0);
+}
@@ -0,0 +1,79 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AS5048A_H
+#define AS5048A_H
+
+#include <cstdint>
+#include "interface.h"
+
+/* A software model of the AS5048A Magnetic Rotary Encoder, as seen through
+ * its SPI interface.
+ *
+ * Every 16-bit frame carries a command (bit 15: even parity, bit 14: read,
+ * bits 13-0: register address), and the chip answers it in the following
+ * frame (bit 15: even parity, bit 14: error flag, bits 13-0: data). A
+ * command with a wrong parity, an unknown register or a frame that is not
+ * 16 bits long is ignored and sets a bit in the error register; the error
+ * flag is then raised in every reply until the error register is read
+ * (which clears it).
+ *
+ * The angle comes from the magnet, a sensor that stands for the physics of
+ * the chip (normally a SimulatedSensor, with its noise and spikes). Writes
+ * are not supported (except for the NOP), as mcontrol never programs the
+ * chip.
+*/
+class AS5048A
+{
+public:
+   // Registers
+   static const uint16_t nop = 0x0000;
+   static const uint16_t clearErrorFlag = 0x0001;
+   static const uint16_t zeroPositionHigh = 0x0016;
+   static const uint16_t zeroPositionLow = 0x0017;
+   static const uint16_t diagnostics = 0x3ffd;
+   static const uint16_t magnitude = 0x3ffe;
+   static const uint16_t angle = 0x3fff;
+
+   // Bits of the error register
+   static const uint16_t framingError = 0x0001;
+   static const uint16_t commandInvalid = 0x0002;
+   static const uint16_t parityError = 0x0004;
+
+   AS5048A(Sensor& magnet_) : magnet(magnet_) {}
+
+   // Exchange a frame: returns the answer to the previous command.
+   uint16_t transfer(uint16_t command);
+
+   // A frame of the wrong length was clocked through.
+   void framingFault();
+
+   // True if the frame has an even number of ones.
+   static bool evenParity(uint16_t frame);
+
+private:
+   uint16_t reply(uint16_t data) const;
+
+   Sensor& magnet;
+   uint16_t pending = 0;
+   uint16_t errors = 0;
+};
+
+#endif // AS5048A_H
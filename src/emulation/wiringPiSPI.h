@@ -0,0 +1,37 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Emulation of the wiringPi SPI functions (see wiringpi.cpp). */
+
+#ifndef EMULATION_WIRINGPISPI_H
+#define EMULATION_WIRINGPISPI_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int wiringPiSPISetupMode(int channel, int speed, int mode);
+int wiringPiSPIDataRW(int channel, unsigned char* data, int len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EMULATION_WIRINGPISPI_H
@@ -0,0 +1,209 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include "as5048a.h"
+#include "simulated.h"
+#include "wiringPi.h"
+#include "wiringPiSPI.h"
+
+/* An emulated Raspberry Pi board, so that the hardware backend (hardware.cpp)
+ * can be built and run without one.
+ *
+ * The GPIO pins are wired as in ControllerBackend: pins 4 and 5 drive the
+ * relays of the H-bridge and pin 1 the PWM of the motor, which is a
+ * SimulatedMotor. SPI channel 0 has the encoder of the axis and channel 1
+ * the reference encoder, both AS5048A models reading the simulated axis.
+ *
+ * A 16-bit transfer takes 16 clock periods at the speed given to
+ * wiringPiSPISetupMode(); the MCONTROL_SPI_TRANSFER environment variable
+ * sets a different time in microseconds (e.g. to include the system call
+ * overhead of the real thing). The calls are not thread safe, but mcontrol
+ * makes them all with the hardware mutex held anyway.
+*/
+
+namespace
+{
+
+const int relay1Pin = 4;
+const int relay2Pin = 5;
+const int pwmPin = 1;
+const int numberOfPins = 32;
+const int numberOfChannels = 2;
+
+struct Board
+{
+   Board() :
+      motor(30), magnet(&motor), referenceMagnet(&motor, 0.01, 0),
+      encoders{AS5048A(magnet), AS5048A(referenceMagnet)}
+   {
+      if (const char* transfer = std::getenv("MCONTROL_SPI_TRANSFER"))
+         transferTime = std::chrono::microseconds(std::atoi(transfer));
+   }
+
+   SimulatedMotor motor;
+   SimulatedSensor magnet;
+   SimulatedSensor referenceMagnet;
+   AS5048A encoders[numberOfChannels];
+
+   int pinModes[numberOfPins] = {};
+   int levels[numberOfPins] = {};
+   unsigned int pwmRange = 1024;
+   int pwmDivisor = 32;
+
+   bool spiReady[numberOfChannels] = {};
+   std::chrono::nanoseconds frameTime[numberOfChannels];
+   std::chrono::nanoseconds transferTime{-1};
+};
+
+Board& board()
+{
+   static Board instance;
+   return instance;
+}
+
+bool validPin(int pin, int mode, const char* function)
+{
+   if (pin < 0 || pin >= numberOfPins || board().pinModes[pin] != mode)
+   {
+      std::cerr << "emulator: ERROR: " << function << "() on pin " << pin
+                << ", which is not set up for it\n";
+      return false;
+   }
+   return true;
+}
+
+// The SPI transfers block for as long as the clocking takes.
+void waitFor(std::chrono::nanoseconds time)
+{
+   auto end = std::chrono::steady_clock::now() + time;
+   while (std::chrono::steady_clock::now() < end)
+      ;
+}
+
+} // namespace
+
+
+extern "C" {
+
+int wiringPiSetup(void)
+{
+   board();
+   return 0;
+}
+
+
+void pinMode(int pin, int mode)
+{
+   if (pin >= 0 && pin < numberOfPins)
+      board().pinModes[pin] = mode;
+}
+
+
+void digitalWrite(int pin, int value)
+{
+   if (!validPin(pin, OUTPUT, "digitalWrite"))
+      return;
+
+   Board& b = board();
+   b.levels[pin] = (value != LOW);
+   if (pin == relay1Pin || pin == relay2Pin)
+      b.motor.setRelays(b.levels[relay1Pin], b.levels[relay2Pin]);
+}
+
+
+void pwmWrite(int pin, int value)
+{
+   if (!validPin(pin, PWM_OUTPUT, "pwmWrite"))
+      return;
+
+   Board& b = board();
+   if (value < 0 || (unsigned int)value > b.pwmRange)
+      std::cerr << "emulator: ERROR: PWM value " << value
+                << " outside of the range\n";
+   if (pin == pwmPin)
+      b.motor.setPWM(100.0 * value / b.pwmRange);
+}
+
+
+void pwmSetMode(int mode)
+{
+   if (mode != PWM_MODE_MS)
+      std::cerr << "emulator: WARNING: only the mark:space PWM mode is emulated\n";
+}
+
+
+void pwmSetRange(unsigned int range)
+{
+   Board& b = board();
+   b.pwmRange = range;
+   b.motor.configurePWM(range, 19200000 / (b.pwmDivisor * range));
+}
+
+
+void pwmSetClock(int divisor)
+{
+   Board& b = board();
+   b.pwmDivisor = divisor;
+   b.motor.configurePWM(b.pwmRange, 19200000 / (divisor * b.pwmRange));
+}
+
+
+int wiringPiSPISetupMode(int channel, int speed, int mode)
+{
+   if (channel < 0 || channel >= numberOfChannels || speed <= 0)
+      return -1;
+   // The AS5048A samples on the falling edge of the clock.
+   if (mode != 1)
+      std::cerr << "emulator: WARNING: SPI mode " << mode
+                << " does not suit the AS5048A\n";
+
+   Board& b = board();
+   b.spiReady[channel] = true;
+   b.frameTime[channel] = std::chrono::nanoseconds(16 * 1000000000LL / speed);
+   return 3 + channel;
+}
+
+
+int wiringPiSPIDataRW(int channel, unsigned char* data, int len)
+{
+   Board& b = board();
+   if (channel < 0 || channel >= numberOfChannels || !b.spiReady[channel])
+      return -1;
+
+   AS5048A& encoder = b.encoders[channel];
+   int i;
+   for (i = 0; i + 1 < len; i += 2)
+   {
+      uint16_t frame = encoder.transfer((data[i] << 8) | data[i + 1]);
+      data[i] = frame >> 8;
+      data[i + 1] = frame & 0xff;
+   }
+   if (i < len)
+      encoder.framingFault();
+
+   waitFor(b.transferTime.count() >= 0 ? b.transferTime
+                                       : b.frameTime[channel] * ((len + 1) / 2));
+   return len;
+}
+
+} // extern "C"
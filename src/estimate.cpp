@@ -0,0 +1,187 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include "controller.h"
+#include "estimate.h"
+
+const unsigned int SlewEstimator::minimumSlews = 5;
+
+// Without a history to check it against, the motor model is trusted to
+// about a quarter of the duration.
+static const float modelOnlySigma = 0.25;
+
+
+void SlewEstimator::configure(const ControllerParams& params)
+{
+   const MotorModel& model = params.model;
+   accelAngle = std::max<degrees>(params.accelAngle, 0.001);
+   tolerance = params.tolerance;
+
+   haveModel = model.valid();
+   if (haveModel)
+   {
+      float lowDuty = std::max<float>(params.minDuty, model.breakawayDuty);
+      lowVelocity = model.velocityAt(lowDuty);
+      highVelocity = model.velocityAt(params.maxDuty);
+
+      // The step at the breakaway duty often measures no velocity at all,
+      // while the axis does creep along at it; take the slowest velocity
+      // that was actually measured instead.
+      for (const MotorModel::Point& point : model.points)
+         if (lowVelocity <= 0 && point.velocity > 0)
+            lowVelocity = point.velocity;
+      haveModel = (highVelocity > 0);
+   }
+   if (!haveModel)
+   {
+      lowVelocity = (float)params.minDuty / params.maxDuty;
+      highVelocity = 1;
+   }
+   // A dead zone at the minimum duty would make the profile take forever;
+   // in practice, the lag of the motor carries the axis through.
+   lowVelocity = std::max(lowVelocity, 0.02f * highVelocity);
+   slope = (highVelocity - lowVelocity) / accelAngle;
+
+   std::chrono::duration<float> deadTime = params.bridge.releaseTime +
+      params.bridge.settleTime + params.bridge.rampTime / 2;
+   priorOverhead = deadTime.count();
+   if (haveModel)
+      priorOverhead += model.timeConstantAt(params.maxDuty);
+
+   n = sumX = sumY = sumXX = sumXY = sumYY = 0;
+   SlewHistoryReader reader;
+   if (!params.historyFile.empty() && reader.open(params.historyFile.c_str()))
+   {
+      SlewRecord record;
+      while (reader.next(record))
+         accumulate(record);
+   }
+   refit();
+}
+
+
+void SlewEstimator::add(const SlewRecord& record)
+{
+   if (accumulate(record))
+      refit();
+}
+
+
+bool SlewEstimator::estimate(degrees distance, SlewEstimate& result) const
+{
+   Fit current = fit.load();
+   if (current.scale <= 0)
+      return false;
+
+   distance = std::abs(distance);
+   if (distance <= tolerance)
+   {
+      // Nothing to do; the slew stops right away.
+      result = SlewEstimate();
+      return true;
+   }
+   float x = profileTime(distance);
+   result.duration = std::max(0.0f, current.overhead + current.scale * x);
+   result.uncertainty = current.relativeSigma * result.duration;
+   if (current.count > 0)
+   {
+      // The prediction interval of the fit, which widens away from the
+      // slews that it was fitted to.
+      float offset = x - current.meanX;
+      result.uncertainty += current.sigma * std::sqrt(1 + 1 / current.count +
+         offset * offset / current.spreadX);
+   }
+   return true;
+}
+
+
+/* The velocity goes from lowVelocity at the start up to highVelocity over
+ * accelAngle, and down again over the last accelAngle (before the
+ * tolerance band), linearly with the distance v(x) = lowVelocity + slope*x.
+ * The time over a ramp of length y is the integral of dx/v(x), that is
+ * log(1 + slope*y/lowVelocity)/slope.
+*/
+float SlewEstimator::profileTime(degrees distance) const
+{
+   degrees travel = distance - tolerance;
+   auto ramp = [this](degrees length) -> float
+      {
+         if (slope * length < 1e-4f * lowVelocity)
+            return length / lowVelocity;
+         return std::log1p(slope * length / lowVelocity) / slope;
+      };
+
+   if (travel <= 2 * accelAngle)
+      return 2 * ramp(travel / 2);
+   return 2 * ramp(accelAngle) + (travel - 2 * accelAngle) / highVelocity;
+}
+
+
+bool SlewEstimator::accumulate(const SlewRecord& record)
+{
+   degrees distance = std::abs(record.targetAngle - record.startAngle);
+   if (record.result != (uint8_t)ReturnValue::Success || record.destalls ||
+       record.duration <= 0 || distance <= tolerance)
+      return false;
+
+   double x = profileTime(distance);
+   double y = record.duration;
+   n++;
+   sumX += x;
+   sumY += y;
+   sumXX += x * x;
+   sumXY += x * y;
+   sumYY += y * y;
+   return true;
+}
+
+
+/* Fits the overhead and the scale when the history has enough slews of
+ * different lengths; the residuals then give the uncertainty. Short of
+ * that, a model is taken as it is, while without one the scale (the
+ * inverse of the full speed) is fitted with the prior overhead, and the
+ * uncertainty stays a guess.
+*/
+void SlewEstimator::refit()
+{
+   Fit result{priorOverhead, haveModel ? 1.0f : 0.0f, 0, modelOnlySigma, 0, 0, 0};
+
+   double spreadX = (n > 0 ? sumXX - sumX * sumX / n : 0);
+   double scale = (spreadX > 0 ? (sumXY - sumX * sumY / n) / spreadX : 0);
+   if (n >= minimumSlews && spreadX > 1e-6 * sumXX && scale > 0)
+   {
+      double overhead = (sumY - scale * sumX) / n;
+      double residuals = sumYY + n * overhead * overhead + scale * scale * sumXX
+         - 2 * overhead * sumY - 2 * scale * sumXY + 2 * overhead * scale * sumX;
+      result.overhead = overhead;
+      result.scale = scale;
+      result.sigma = std::sqrt(std::max(0.0, residuals) / (n - 2));
+      result.relativeSigma = 0;
+      result.count = n;
+      result.meanX = sumX / n;
+      result.spreadX = spreadX;
+   }
+   else if (!haveModel && sumX > 0)
+      result.scale = std::max(0.0, (sumY - n * priorOverhead) / sumX);
+   fit.store(result);
+}
@@ -0,0 +1,113 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ESTIMATE_H
+#define ESTIMATE_H
+
+#include "angles.h"
+#include "history.h"
+#include "seqlock.h"
+
+struct ControllerParams;
+
+/* A predicted slew. */
+struct SlewEstimate
+{
+   float duration = 0;      // seconds
+   float uncertainty = 0;   // standard deviation of the duration, seconds
+};
+
+/* Predicts how long slews take, for schedulers that order their targets.
+ *
+ * The duty law ramps the duty linearly with the distance from the start
+ * and to the target over accelAngle, and so does the velocity: with the
+ * motor model, from the velocity at the minimum duty to the one at
+ * maxDuty (see feedforwardDuty()), and without it in proportion to the
+ * duty. The time of a slew over a given distance then follows in closed
+ * form (the profile time). A least-squares fit of the durations of past
+ * slews, duration = overhead + scale * profile time, takes care of the
+ * relay dead times, the lag of the motor, the final approach and the
+ * speed without a model; the uncertainty is its prediction interval. Until
+ * there are minimumSlews slews in the history, the motor model is taken as
+ * it is (with the relay dead times as the overhead), or only the speed is
+ * fitted without one, and the uncertainty is a generous fraction of the
+ * duration. De-stall maneuvers are not predicted.
+ *
+ * The fit is updated as slews finish, while estimate() can be called from
+ * any thread at any time; an estimate takes well under a microsecond.
+*/
+class SlewEstimator
+{
+public:
+   // The fewest slews (of different lengths) to fit to.
+   static const unsigned int minimumSlews;
+
+   // Set up the velocity profile and fit it to the slews in the history
+   // file (if any). Not while slews are being added.
+   void configure(const ControllerParams& params);
+
+   // Refine the fit with a finished slew. Only successful slews without
+   // de-stall maneuvers count.
+   void add(const SlewRecord& record);
+
+   // Predict a slew over the given distance. Returns false if there is
+   // neither a motor model nor any history to go by.
+   bool estimate(degrees distance, SlewEstimate& result) const;
+
+private:
+   struct Fit
+   {
+      float overhead;        // seconds
+      float scale;           // of the profile time
+      float sigma;           // of the residuals, seconds
+      float relativeSigma;   // of the duration, without a fit
+      // the slews fitted to and their profile times (for the prediction
+      // interval)
+      float count;
+      float meanX;
+      float spreadX;         // sum of the squared deviations from meanX
+   };
+
+   // The time of the velocity profile over the distance actually travelled
+   // (up to the tolerance band), in seconds with the model, and in seconds
+   // at a full speed of one degree per second without it.
+   float profileTime(degrees distance) const;
+
+   // Add a slew to the sums (if it counts).
+   bool accumulate(const SlewRecord& record);
+   void refit();
+
+   // The velocity profile.
+   bool haveModel = false;
+   degrees accelAngle = 20;
+   degrees tolerance = 0.1;
+   float lowVelocity = 0.1;
+   float highVelocity = 1;
+   float slope = 0;
+   float priorOverhead = 0;
+
+   // Sums for the least-squares fit of the durations (y) to the profile
+   // times (x).
+   double n = 0, sumX = 0, sumY = 0, sumXX = 0, sumXY = 0, sumYY = 0;
+
+   SeqLock<Fit> fit;
+};
+
+#endif // ESTIMATE_H
@@ -0,0 +1,232 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <cstdint>
+#include <system_error>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include "eventloop.h"
+
+// Failures to set up the loop leave us unable to control the motor at all,
+// so they are treated the same way as hardware initialization failures.
+static int checked(int result, const char* what)
+{
+   if (result == -1)
+      throw std::system_error(errno, std::generic_category(), what);
+   return result;
+}
+
+
+static void addToEpoll(int epollFd, int fd)
+{
+   epoll_event event;
+   event.events = EPOLLIN;
+   event.data.fd = fd;
+   checked(epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event), "epoll_ctl");
+}
+
+
+EventLoop::EventLoop() :
+   signals(0)
+{
+   try
+   {
+      epollFd = checked(epoll_create1(EPOLL_CLOEXEC), "epoll_create1");
+      timerFd = checked(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC),
+                        "timerfd_create");
+      eventFd = checked(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), "eventfd");
+      addToEpoll(epollFd, timerFd);
+      addToEpoll(epollFd, eventFd);
+   }
+   catch (...)
+   {
+      closeAll();
+      throw;
+   }
+}
+
+
+EventLoop::~EventLoop()
+{
+   releaseSignals();
+   closeAll();
+}
+
+
+void EventLoop::closeAll()
+{
+   for (int fd : { eventFd, timerFd, epollFd })
+      if (fd != -1)
+         close(fd);
+}
+
+
+bool EventLoop::startTicks(std::chrono::nanoseconds period)
+{
+   itimerspec spec;
+   spec.it_interval.tv_sec = period.count() / 1000000000;
+   spec.it_interval.tv_nsec = period.count() % 1000000000;
+   spec.it_value = spec.it_interval;
+   if (timerfd_settime(timerFd, 0, &spec, nullptr) == -1)
+      return false;
+   tickPeriod = period;
+   nextTick = std::chrono::steady_clock::now() + period;
+   return true;
+}
+
+
+void EventLoop::stopTicks()
+{
+   // Should this fail, the ticks that keep coming are only ever consumed by
+   // the next wait(), which is preceded by startTicks() anyway.
+   itimerspec spec = {};
+   timerfd_settime(timerFd, 0, &spec, nullptr);
+   uint64_t expirations;
+   while (read(timerFd, &expirations, sizeof(expirations)) > 0)
+      ;
+}
+
+
+bool EventLoop::catchSignals()
+{
+   if (signalFd != -1)
+      return true;
+
+   sigset_t mask;
+   sigemptyset(&mask);
+   sigaddset(&mask, SIGINT);
+   sigaddset(&mask, SIGTERM);
+   pthread_sigmask(SIG_BLOCK, &mask, &previousMask);
+   signalFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+   epoll_event event;
+   event.events = EPOLLIN;
+   event.data.fd = signalFd;
+   if (signalFd == -1 || epoll_ctl(epollFd, EPOLL_CTL_ADD, signalFd, &event) == -1)
+   {
+      int error = errno;
+      if (signalFd != -1)
+         close(signalFd);
+      signalFd = -1;
+      pthread_sigmask(SIG_SETMASK, &previousMask, nullptr);
+      errno = error;
+      return false;
+   }
+   return true;
+}
+
+
+void EventLoop::releaseSignals()
+{
+   if (signalFd == -1)
+      return;
+
+   epoll_ctl(epollFd, EPOLL_CTL_DEL, signalFd, nullptr);
+   close(signalFd);
+   signalFd = -1;
+   pthread_sigmask(SIG_SETMASK, &previousMask, nullptr);
+}
+
+
+void EventLoop::notify()
+{
+   uint64_t one = 1;
+   ssize_t result = write(eventFd, &one, sizeof(one));
+   (void)result;   // the counter can only overflow after 2^64 - 1 wakeups
+}
+
+
+auto EventLoop::wait(std::chrono::steady_clock::time_point deadline) -> Event
+{
+   while (true)
+   {
+      int timeout = -1;
+      if (deadline != std::chrono::steady_clock::time_point::max())
+      {
+         auto remaining = deadline - std::chrono::steady_clock::now();
+         if (remaining <= std::chrono::steady_clock::duration::zero())
+            return Event::Timeout;
+         // Round up, so that we never return before the deadline.
+         timeout = std::chrono::duration_cast<std::chrono::milliseconds>(
+            remaining + std::chrono::milliseconds(1) -
+            std::chrono::nanoseconds(1)).count();
+      }
+
+      epoll_event events[3];
+      int count = epoll_wait(epollFd, events, 3, timeout);
+      if (count == -1 && errno != EINTR)
+         return Event::Error;
+
+      // Signals and notifications take precedence over the ticks.
+      Event result = Event::Timeout;
+      for (int i = 0; i < count; i++)
+      {
+         int fd = events[i].data.fd;
+         if (fd == signalFd)
+         {
+            signalfd_siginfo info;
+            while (read(signalFd, &info, sizeof(info)) == sizeof(info))
+               signals += (info.ssi_signo == SIGTERM ? 2 : 1);
+            result = Event::Signal;
+         }
+         else if (fd == eventFd)
+         {
+            uint64_t value;
+            while (read(eventFd, &value, sizeof(value)) > 0)
+               ;
+            if (result != Event::Signal)
+               result = Event::Notification;
+         }
+         else if (fd == timerFd)
+         {
+            uint64_t expirations, total = 0;
+            while (read(timerFd, &expirations, sizeof(expirations)) > 0)
+               total += expirations;
+            if (total > 0)
+            {
+               // The ticks are periodic from startTicks() on, so the latest
+               // one was due total - 1 periods after the next expected one.
+               auto due = nextTick + (total - 1) * tickPeriod;
+               lateness = std::chrono::steady_clock::now() - due;
+               missed = total - 1;
+               nextTick = due + tickPeriod;
+            }
+            if (result == Event::Timeout)
+               result = Event::Tick;
+         }
+      }
+      if (result != Event::Timeout)
+         return result;
+   }
+}
+
+
+void blockSignalsInThread()
+{
+   sigset_t mask;
+   sigfillset(&mask);
+   pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+}
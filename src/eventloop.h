@@ -0,0 +1,106 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+
+/* The waiting part of the control loop.
+ *
+ * Everything the control loop waits for is a file descriptor in a single
+ * epoll set: a timerfd for the ticks of the loop, a signalfd for SIGINT and
+ * SIGTERM (while catchSignals() is in effect) and an eventfd through which
+ * other threads can wake the loop up. Between the ticks, the loop sleeps in
+ * the kernel, and a signal or a command ends the sleep immediately.
+ *
+ * The signals are only counted here; it is up to the loop to act on them.
+ * SIGINT counts as one interruption and SIGTERM as two (which makes it an
+ * emergency stop in the control loop).
+ *
+ * Failures to set the loop up throw std::system_error. Once the motor runs,
+ * nothing throws (the control loop must not allocate, and it has to stop the
+ * motor first): failures of the ticks are reported through the return values.
+*/
+class EventLoop
+{
+public:
+   enum class Event { Tick, Signal, Notification, Timeout, Error };
+
+   EventLoop();
+   ~EventLoop();
+
+   // Start ticking with the given period; the first tick comes one period
+   // from now. The ticks are periodic, so a late wait() does not delay the
+   // ticks after it. Returns false (with errno set) if the timer could not
+   // be set.
+   bool startTicks(std::chrono::nanoseconds period);
+   void stopTicks();
+
+   // Receive SIGINT and SIGTERM through the loop instead of their usual
+   // dispositions. The signals are blocked in the calling thread (other
+   // threads of the process must keep them blocked, too) until
+   // releaseSignals() restores the previous signal mask. Returns false (with
+   // errno set, and the signals left alone) on failure.
+   bool catchSignals();
+   void releaseSignals();
+
+   // Wake the loop up. Can be called from any thread and from signal
+   // handlers.
+   void notify();
+
+   // Wait for the next tick, a signal or a notification, but not past the
+   // deadline. Returns Event::Error (with errno set) if waiting failed.
+   Event wait(std::chrono::steady_clock::time_point deadline =
+                 std::chrono::steady_clock::time_point::max());
+
+   // The number of interruptions received through signals so far.
+   inline int signalCount() const { return signals; }
+
+   // For the latest tick that wait() returned: how long after it was due
+   // (with the period in effect for it) wait() returned, and how many ticks
+   // before it were missed altogether.
+   inline std::chrono::nanoseconds tickLateness() const { return lateness; }
+   inline uint64_t missedTicks() const { return missed; }
+
+private:
+   void closeAll();
+
+   int epollFd = -1;
+   int timerFd = -1;
+   int eventFd = -1;
+   int signalFd = -1;
+   sigset_t previousMask;
+   std::atomic_int signals;
+
+   std::chrono::nanoseconds tickPeriod{0};
+   std::chrono::steady_clock::time_point nextTick;
+   std::chrono::nanoseconds lateness{0};
+   uint64_t missed = 0;
+};
+
+// Block all signals in the calling thread (for helper threads, which should
+// leave the signals to the main thread).
+void blockSignalsInThread();
+
+#endif // EVENTLOOP_H
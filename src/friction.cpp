@@ -0,0 +1,121 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <libconfig.h++>
+#include "friction.h"
+
+const degrees FrictionMap::binWidth = 5.0;
+const float FrictionMap::raiseStep = 2.0;
+const float FrictionMap::lowerStep = 0.25;
+
+
+FrictionMap::FrictionMap() :
+   bins((unsigned int)(360.0 / binWidth), 0.0)
+{}
+
+
+unsigned int FrictionMap::bin(CookedAngle angle) const
+{
+   int index = (int)(mod360(angle.val) / binWidth);
+   return std::min<unsigned int>(index, bins.size() - 1);
+}
+
+
+float FrictionMap::minDuty(CookedAngle angle, float fallback) const
+{
+   float value = bins[bin(angle)];
+   return (value > 0 ? value : fallback);
+}
+
+
+void FrictionMap::stalled(CookedAngle angle, float duty, float maxDuty)
+{
+   // A stall at (or close to) the maximum duty is not something a higher
+   // minimum could cure (the axis is jammed or at an end switch); learning
+   // from it would pin the bin at the maximum for good.
+   float ceiling = maxDuty - raiseStep;
+   if (duty >= ceiling)
+      return;
+
+   float& value = bins[bin(angle)];
+   float raised = std::min(std::max(value, duty) + raiseStep, ceiling);
+   if (raised != value)
+   {
+      value = raised;
+      dirty = true;
+   }
+}
+
+
+void FrictionMap::moved(CookedAngle angle, float maxDuty, float fallback)
+{
+   float& value = bins[bin(angle)];
+   float current = (value > 0 ? value : fallback);
+   if (maxDuty > current || current <= lowerStep)
+      return;
+
+   value = current - lowerStep;
+   dirty = true;
+}
+
+
+bool FrictionMap::load(const char* filename)
+{
+   libconfig::Config map;
+   map.setAutoConvert(true);
+   map.readFile(filename);
+
+   float width = map.lookup("friction.binWidth");
+   libconfig::Setting& minDuty = map.lookup("friction.minDuty");
+   if (width != binWidth || !minDuty.isArray() ||
+       minDuty.getLength() != (int)bins.size())
+      return false;
+
+   for (unsigned int i = 0; i < bins.size(); i++)
+      bins[i] = minDuty[i];
+   dirty = false;
+   return true;
+}
+
+
+bool FrictionMap::save(const char* filename)
+{
+   FILE* file = fopen(filename, "w");
+   if (!file)
+      return false;
+
+   fprintf(file,
+      "// Friction map, maintained by mcontrol: the minimum duty cycle that\n"
+      "// keeps the axis moving, for every binWidth degrees of cooked angles\n"
+      "// (zero where not learned yet).\n"
+      "friction:\n{\n"
+      "   binWidth = %.1f\n"
+      "   minDuty = [", binWidth);
+   for (unsigned int i = 0; i < bins.size(); i++)
+      fprintf(file, "%s%.2f", (i ? ", " : " "), bins[i]);
+   fprintf(file, " ]\n}\n");
+
+   if (fclose(file) != 0)
+      return false;
+   dirty = false;
+   return true;
+}
@@ -0,0 +1,74 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRICTION_H
+#define FRICTION_H
+
+#include <vector>
+#include "angles.h"
+
+/* A map of the minimum duty cycle that keeps the axis moving, over bins of
+ * cooked angles.
+ *
+ * Friction and the gravity load vary along the axis, so a single minimum
+ * duty is too low in some places and too high in others. The map is learned
+ * from the slews: a stall raises the minimum of its bin by raiseStep, while
+ * a stall check passed at (or below) the minimum of the bin lowers it by
+ * lowerStep, so that it keeps probing for the lowest duty that still works.
+ * Bins without any experience use the global minimum duty.
+*/
+class FrictionMap
+{
+public:
+   static const degrees binWidth;
+   static const float raiseStep;
+   static const float lowerStep;
+
+   FrictionMap();
+
+   // The minimum duty at the given angle (fallback if not learned yet).
+   float minDuty(CookedAngle angle, float fallback) const;
+
+   // The axis stalled at the given duty. The minimum never goes above
+   // maxDuty - raiseStep, and stalls above that are not learned from.
+   void stalled(CookedAngle angle, float duty, float maxDuty);
+
+   // The axis kept moving with duties of at most maxDuty since the previous
+   // stall check.
+   void moved(CookedAngle angle, float maxDuty, float fallback);
+
+   // Whether the map changed since it was last loaded or saved.
+   inline bool changed() const { return dirty; }
+
+   // The map file uses the syntax of the configuration file. load() throws
+   // the libconfig exceptions and returns false if the map does not fit
+   // the bins; save() returns false on failure (see errno).
+   bool load(const char* filename);
+   bool save(const char* filename);
+
+private:
+   unsigned int bin(CookedAngle angle) const;
+
+   // Zero for bins that were not learned yet.
+   std::vector<float> bins;
+   bool dirty = false;
+};
+
+#endif // FRICTION_H
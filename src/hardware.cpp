@@ -18,11 +18,14 @@
  *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
 #include <cstdint>
 #include <wiringPi.h>
 #include <wiringPiSPI.h>
 #include "hardware.h"
+#include "trace.h"
 
 ///
 // H-bridge and PWM functions
@@ -38,31 +41,43 @@ HardwareMotor::HardwareMotor(int setPin1, int setPin2, int setPinPWM) :
    // PWM setup
    pinMode (pinPWM, PWM_OUTPUT);
    pwmSetMode(PWM_MODE_MS);
-   pwmSetClock(16);
-   pwmSetRange(100);
+   configurePWM(100, 12000);
+}
+
+void HardwareMotor::configurePWM(unsigned int range, unsigned int frequency)
+{
+   const double baseClock = 19.2e6;
+   long divisor = std::lround(baseClock / ((double)range * frequency));
+   pwmSetClock(std::min(std::max(divisor, 2L), 4095L));
+   pwmSetRange(range);
+   pwmRange = range;
 }
 
 void HardwareMotor::turnOnDir1()
 {
+   TRACE_SPAN("relays");
    digitalWrite(pin2, LOW);
    digitalWrite(pin1, HIGH);
 }
 
 void HardwareMotor::turnOnDir2()
 {
+   TRACE_SPAN("relays");
    digitalWrite(pin1, LOW);
    digitalWrite(pin2, HIGH);
 }
 
 void HardwareMotor::turnOff()
 {
+   TRACE_SPAN("relays");
    digitalWrite(pin1, LOW);
    digitalWrite(pin2, LOW);
 }
 
-void HardwareMotor::setPWM(unsigned short duty)
+void HardwareMotor::setPWM(float duty)
 {
-   pwmWrite(pinPWM, duty);
+   TRACE_SPAN("pwmWrite");
+   pwmWrite(pinPWM, std::lround(duty * pwmRange / 100));
 }
 
 ///
@@ -82,7 +97,7 @@ void HardwareMotor::setPWM(unsigned short duty)
 #define CMD_DIAGDATA 0x3ffd
 #define CMD_NOOP 0x0000
 
-uint16_t sendReceive(uint16_t command, bool verbose = false)
+uint16_t sendReceive(int channel, uint16_t command, bool verbose = false)
 {
    if (BITCOUNT(command) % 2)
       command |= 0x8000;
@@ -94,7 +109,8 @@ uint16_t sendReceive(uint16_t command, bool verbose = false)
    if (verbose)
       printf("sending %02x%02x   ", data[0], data[1]);
 
-   wiringPiSPIDataRW(0, data, 2);
+   TRACE_SPAN("spi transfer");
+   wiringPiSPIDataRW(channel, data, 2);
 
    if (verbose)
       printf("received %02x%02x\n", data[0], data[1]);
@@ -103,14 +119,20 @@ uint16_t sendReceive(uint16_t command, bool verbose = false)
 }
 
 
-RawAngle HardwareSensor::getRawAngle()
+RawCode HardwareSensor::getRawCode()
 {
    // Send a SPI request for angle data, ignoring the result as it belongs
    // to the previously issued command.
-   sendReceive(CMD_ANGLEDATA | FLAG_READ);
+   sendReceive(channel, CMD_ANGLEDATA | FLAG_READ);
 
    // Flush the command with a NOOP and record the reply.
-   uint16_t angledata = sendReceive(CMD_NOOP);
+   uint16_t angledata = sendReceive(channel, CMD_NOOP);
 
-   return RawAngle((degrees)(angledata & 0x3fff) * 360.0f / 0x3fff);
+   return RawCode(angledata);
+}
+
+
+RawAngle HardwareSensor::getRawAngle()
+{
+   return RawAngle(getRawCode());
 }
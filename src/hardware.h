@@ -29,7 +29,7 @@
  * transistor serves to control the power via PWM.
  *
 */
-class HardwareMotor : public Motor
+class HardwareMotor final : public Motor
 {
 public:
    /* Create a HardwareMotor instance.
@@ -46,7 +46,13 @@ public:
    virtual void turnOff();
 
    // Set PWM duty cycle in percent.
-   virtual void setPWM(unsigned short duty);
+   virtual void setPWM(float duty);
+
+   // Set the number of PWM steps and the PWM frequency (in Hz). The
+   // frequency is only approximate, as the PWM clock of the Raspberry Pi
+   // is 19.2 MHz divided by an integer (between 2 and 4095): range *
+   // frequency can not exceed 9.6 MHz.
+   void configurePWM(unsigned int range, unsigned int frequency);
 
 protected:
    // Spin the motor in direction 1 (hardware dependent).
@@ -58,13 +64,21 @@ protected:
    int pin1;
    int pin2;
    int pinPWM;
+   unsigned int pwmRange = 100;
 };
 
 
-class HardwareSensor : public Sensor
+class HardwareSensor final : public Sensor
 {
 public:
+   // channel: SPI channel (chip select) the encoder is connected to
+   HardwareSensor(int setChannel = 0) : channel(setChannel) {}
+
    virtual RawAngle getRawAngle();
+   virtual RawCode getRawCode();
+
+protected:
+   int channel;
 };
 
 #endif // HARDWARE_H
@@ -0,0 +1,233 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <string>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "history.h"
+#include "stats.h"
+
+static const char magic[8] = {'m', 'c', 's', 'l', 'e', 'w', '0', '1'};
+
+
+/* Creates a history file with just the header. The file is written under
+ * a temporary name and linked to the final one (unless another writer got
+ * there first), so that it never appears without its header and the
+ * records of concurrent writers always land behind it.
+*/
+static bool createHistoryFile(const char* filename)
+{
+   std::string temporary = std::string(filename) + ".XXXXXX";
+   int fd = mkstemp(&temporary[0]);
+   if (fd == -1)
+      return false;
+
+   bool ok = (write(fd, magic, sizeof(magic)) == sizeof(magic) &&
+              fchmod(fd, 0644) == 0);
+   if (close(fd) != 0)
+      ok = false;
+   if (ok && link(temporary.c_str(), filename) != 0 && errno != EEXIST)
+      ok = false;
+
+   int error = errno;
+   unlink(temporary.c_str());
+   errno = error;
+   return ok;
+}
+
+
+bool appendSlewRecord(const char* filename, const SlewRecord& record)
+{
+   int fd = ::open(filename, O_WRONLY | O_APPEND);
+   if (fd == -1 && errno == ENOENT)
+   {
+      if (!createHistoryFile(filename))
+         return false;
+      fd = ::open(filename, O_WRONLY | O_APPEND);
+   }
+   if (fd == -1)
+      return false;
+
+   // A partial record left at the end by an interrupted write is cut off.
+   // The file is locked meanwhile, as a record appended by another writer
+   // between the fstat() and the ftruncate() would be lost.
+   bool ok = (flock(fd, LOCK_EX) == 0);
+   struct stat status;
+   if (ok && fstat(fd, &status) != 0)
+      ok = false;
+   if (ok && status.st_size >= (off_t)sizeof(magic))
+   {
+      off_t torn = (status.st_size - sizeof(magic)) % sizeof(SlewRecord);
+      if (torn != 0 && ftruncate(fd, status.st_size - torn) != 0)
+         ok = false;
+   }
+   if (ok)
+      ok = (write(fd, &record, sizeof(record)) == sizeof(record));
+
+   int error = errno;
+   close(fd);
+   errno = error;
+   return ok;
+}
+
+
+SlewHistoryReader::~SlewHistoryReader()
+{
+   if (file)
+      fclose(file);
+}
+
+
+bool SlewHistoryReader::open(const char* filename)
+{
+   file = fopen(filename, "rb");
+   if (!file)
+      return false;
+
+   char header[sizeof(magic)];
+   if (fread(header, sizeof(header), 1, file) != 1 ||
+       memcmp(header, magic, sizeof(magic)) != 0)
+   {
+      fclose(file);
+      file = nullptr;
+      errno = 0;
+      return false;
+   }
+   return true;
+}
+
+
+bool SlewHistoryReader::next(SlewRecord& record)
+{
+   if (position == filled)
+   {
+      // A partial record at the end (an interrupted write) is ignored.
+      filled = fread(block, sizeof(SlewRecord), blockLength, file);
+      position = 0;
+      if (filled == 0)
+         return false;
+   }
+   record = block[position++];
+   return true;
+}
+
+
+/* The trends of a group of slews. The histograms are those of the latencies;
+ * they take any non-negative integers, here milliseconds and microdegrees.
+ * Their percentiles are only precise to some 6 percent, so the slew times
+ * and the peak velocities are also averaged exactly, to show slow trends.
+*/
+struct Trend
+{
+   void add(const SlewRecord& record)
+   {
+      slews++;
+      destalls += record.destalls;
+      totalDuration += record.duration;
+      totalPeakVelocity += record.peakVelocity;
+      duration.record(std::chrono::nanoseconds((int64_t)(record.duration * 1e3)));
+      if (record.result == 0)
+         error.record(std::chrono::nanoseconds((int64_t)(record.finalError * 1e6)));
+      else
+         failures++;
+   }
+
+   void print(FILE* stream, const char* label) const
+   {
+      fprintf(stream, "%-10s %7lu %6lu %8.2f %8.2f %9.2f %8.2f %8.3f %8.3f\n",
+              label, slews, failures,
+              totalDuration / slews,
+              duration.percentile(0.95).count() / 1e3,
+              totalPeakVelocity / slews,
+              (double)destalls / slews,
+              error.percentile(0.5).count() / 1e6,
+              error.percentile(0.95).count() / 1e6);
+   }
+
+   unsigned long slews = 0;
+   unsigned long failures = 0;
+   unsigned long destalls = 0;
+   double totalDuration = 0;
+   double totalPeakVelocity = 0;
+   LatencyHistogram duration;
+   LatencyHistogram error;
+};
+
+
+// The Monday that starts the (UTC) week of the given time.
+static int64_t weekStart(int64_t time)
+{
+   const int64_t week = 7 * 24 * 3600;
+   const int64_t firstMonday = 4 * 24 * 3600;   // 1970-01-05
+   int64_t since = time - firstMonday;
+   int64_t weeks = since / week - (since % week < 0 ? 1 : 0);
+   return firstMonday + weeks * week;
+}
+
+
+bool reportHistory(const char* filename, FILE* stream)
+{
+   SlewHistoryReader reader;
+   if (!reader.open(filename))
+      return false;
+
+   fprintf(stream, "%-10s %7s %6s %8s %8s %9s %8s %8s %8s\n", "week of",
+           "slews", "failed", "time", "time p95", "peak vel", "destalls",
+           "err p50", "err p95");
+
+   // The records come in the order of the slews, so the weeks can be
+   // summarized one after another.
+   Trend all;
+   Trend thisWeek;
+   int64_t currentWeek = 0;
+   auto printWeek = [&]()
+      {
+         time_t start = currentWeek;
+         struct tm date;
+         char label[16];
+         strftime(label, sizeof(label), "%Y-%m-%d", gmtime_r(&start, &date));
+         thisWeek.print(stream, label);
+      };
+
+   SlewRecord record;
+   while (reader.next(record))
+   {
+      int64_t week = weekStart(record.time);
+      if (thisWeek.slews && week != currentWeek)
+      {
+         printWeek();
+         thisWeek = Trend();
+      }
+      currentWeek = week;
+      thisWeek.add(record);
+      all.add(record);
+   }
+   if (thisWeek.slews)
+      printWeek();
+   if (all.slews)
+      all.print(stream, "all");
+   return true;
+}
@@ -0,0 +1,92 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <cstdint>
+#include <cstdio>
+
+/* A summary of one slew, as kept in the slew history. The angles are
+ * cooked angles; the final angle is the one measured when the control loop
+ * stopped.
+*/
+struct SlewRecord
+{
+   int64_t time = 0;             // start of the slew, seconds since the epoch
+   float startAngle = 0;
+   float targetAngle = 0;
+   float finalAngle = 0;
+   float duration = 0;           // seconds
+   float peakVelocity = 0;       // degrees per second
+   float finalError = 0;         // degrees from the target
+   uint16_t destalls = 0;        // de-stall maneuvers performed
+   uint16_t stallChecks = 0;     // motor checks that came to a verdict
+   uint8_t result = 0;           // ReturnValue
+   uint8_t reserved[3] = {0, 0, 0};
+};
+
+static_assert(sizeof(SlewRecord) == 40, "the history file format depends on it");
+
+
+/* The slew history is an append-only file: a short header followed by
+ * SlewRecords in the native byte order. A new file appears under its name
+ * with the header already in place, and every record goes out with a
+ * single write() to a file opened with O_APPEND, so concurrent writers do
+ * not get in each other's way and a crash loses at most the record being
+ * written. The torn remains of such a record are cut off before the next
+ * one is appended, so that they do not shift all the records after them.
+*/
+bool appendSlewRecord(const char* filename, const SlewRecord& record);
+
+
+/* Reads a history file a block of records at a time. */
+class SlewHistoryReader
+{
+public:
+   ~SlewHistoryReader();
+
+   // Returns false (with errno set) if the file can not be opened, or if it
+   // is not a history file (errno is then zero).
+   bool open(const char* filename);
+
+   // The next record; false at the end of the file.
+   bool next(SlewRecord& record);
+
+private:
+   static const unsigned int blockLength = 256;
+
+   FILE* file = nullptr;
+   SlewRecord block[blockLength];
+   unsigned int filled = 0;
+   unsigned int position = 0;
+};
+
+
+/* Print the weekly trends of the slews in a history file: the number of
+ * slews and of failed ones, the mean and 95th percentile of the duration,
+ * the mean peak velocity, the de-stall maneuvers per slew and the median
+ * and 95th percentile of the final error (of the successful slews).
+ * Memory use does not depend on the length of the history. Returns false
+ * if the file could not be read.
+*/
+bool reportHistory(const char* filename, FILE* stream);
+
+#endif // HISTORY_H
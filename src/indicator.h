@@ -0,0 +1,145 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INDICATOR_H
+#define INDICATOR_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include "angles.h"
+#include "output.h"
+
+/* An abstract progress indicator. It provides the core of a progress indicator
+ * that prints the current state at predetermined time intervals.
+*/
+class ProgressIndicator
+{
+public:
+   ProgressIndicator(CookedAngle initial_, CookedAngle target_) :
+      initial(0), target(0)
+   {
+      reset(initial_, target_);
+   }
+
+   virtual ~ProgressIndicator() = default;
+
+   // Print the current progress if either enough time has elapsed from the
+   // previous printing or the forcePrint parameter is true.
+   void print(CookedAngle angle, bool forcePrint = false)
+   {
+      auto now = std::chrono::steady_clock::now();
+      if (!forcePrint && now < previousPrint + printPeriod)
+         return;
+      previousPrint = now;
+      printProgress(angle);
+   }
+
+   // Set new initial and target angles.
+   void reset(CookedAngle initial_, CookedAngle target_)
+   {
+      initial = initial_;
+      target = target_;
+      previousPrint = std::chrono::steady_clock::now() - printPeriod;
+   }
+
+   // Finalize the output (for example, by printing a final newline).
+   virtual void finalize() = 0;
+
+protected:
+   // Do the actual printing.
+   virtual void printProgress(CookedAngle angle) = 0;
+
+   CookedAngle initial;
+   CookedAngle target;
+   std::chrono::steady_clock::time_point previousPrint;
+
+   static const int length = 30;
+   static constexpr std::chrono::milliseconds printPeriod{100};
+};
+
+// An ASCII progress bar.
+class BarIndicator : public ProgressIndicator
+{
+public:
+   BarIndicator(CookedAngle initial_, CookedAngle target_) :
+      ProgressIndicator(initial_, target_) {}
+
+   virtual void finalize()
+   {
+      asyncOutput().message(stdout, "\n");
+   }
+
+private:
+   virtual void printProgress(CookedAngle angle)
+   {
+      char bar[length + 1];
+      int position = std::round(length * (angle - initial)/(target - initial));
+      position = std::min(std::max( position, 0), length - 1);
+      std::fill(bar, bar + position, '=');
+      bar[position] = '>';
+      std::fill(bar + position + 1, bar + length, '-');
+      bar[length] = '\0';
+      asyncOutput().progress(stdout, "\r\033[K%6.1f degrees %s",
+                             UserAngle(angle).val, bar);
+   }
+
+   // Length of the bar in characters.
+   static const int length = 30;
+};
+
+
+// No progress output at all (when something else reports the progress).
+class NullIndicator : public ProgressIndicator
+{
+public:
+   NullIndicator(CookedAngle initial_, CookedAngle target_) :
+      ProgressIndicator(initial_, target_) {}
+
+   virtual void finalize() {}
+
+private:
+   virtual void printProgress(CookedAngle angle) {}
+};
+
+
+/* An indicator with simple numeric output suitable for further processing.
+ * It outputs lines with the format:
+ *
+ * <current angle> <progress percent>
+*/
+class PercentIndicator : public ProgressIndicator
+{
+public:
+   PercentIndicator(CookedAngle initial_, CookedAngle target_) :
+      ProgressIndicator(initial_, target_) {}
+
+   virtual void finalize() {}
+
+private:
+   virtual void printProgress(CookedAngle angle)
+   {
+      asyncOutput().progress(stdout, "%.1f %d\n",
+         UserAngle(angle).val,
+         (int)std::round(100 * (angle - initial)/(target - initial)));
+   }
+};
+
+#endif // INDICATOR_H
@@ -28,6 +28,10 @@ class Sensor
 {
 public:
    virtual RawAngle getRawAngle() = 0;
+
+   // The readout as a binary angle. Sensors that do not natively deliver
+   // codes get their readouts quantized.
+   virtual RawCode getRawCode() { return RawCode::fromDegrees(getRawAngle().val); }
 };
 
 
@@ -43,8 +47,9 @@ public:
    // Disconnect the motor from the power source.
    virtual void turnOff() = 0;
 
-   // Set the PWM duty cycle in percent.
-   virtual void setPWM(unsigned short duty) = 0;
+   // Set the PWM duty cycle in percent. Fractions of a percent are kept
+   // as far as the resolution of the PWM allows.
+   virtual void setPWM(float duty) = 0;
 
    // Invert the polarity (sense of spinning) of the motor.
    void invertPolarity(bool invert);
@@ -19,12 +19,21 @@
  */
 
 #include <iostream>
+#include <fstream>
 #include <vector>
 #include <tclap/CmdLine.h>
 #include <cstdio>
+#include <cerrno>
+#include <csignal>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <system_error>
+#include <algorithm>
 #include <unistd.h>
-#include <libconfig.h++>
+#include "calibration.h"
 #include "controller.h"
+#include "sharedstatus.h"
 
 #ifndef CONFIG_FILE_PATH
 #define CONFIG_FILE_PATH "."
@@ -32,6 +41,103 @@
 
 const char* configFilename = CONFIG_FILE_PATH "/mcontrol.conf";
 
+// Print out the outcome of a linearization calibration.
+void reportCalibration(const HarmonicFit& fit, const ResidualStats& check)
+{
+   printf("samples used for the fit: %lu\n", fit.samples());
+   printf("fit residual (RMS): %.4f degrees\n", fit.rmsResidual());
+   printf("check residual (RMS / maximum): %.4f / %.4f degrees (%lu samples)\n",
+          check.rms(), check.maximum, check.count);
+
+   printf("linearization = [");
+   for (float k : fit.coefficients())
+      printf(" %.6g", k);
+   printf(" ]\n");
+}
+
+// Set by SIGINT to end the monitoring.
+std::atomic_bool monitorInterrupted(false);
+
+void monitor_int_handler(int sig)
+{
+   monitorInterrupted = true;
+}
+
+// Print a timestamp as seconds since the epoch.
+void printTimestamp(std::chrono::system_clock::time_point time)
+{
+   auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+      time.time_since_epoch()).count();
+   printf("%lld.%06lld", (long long)(us / 1000000), (long long)(us % 1000000));
+}
+
+/* Sample the angle at the given rate until interrupted, printing either
+ * every sample ("<time> <angle>") or, with a nonzero summary, the
+ * minimum, maximum and mean of every so many samples ("<time> <min> <max>
+ * <mean>", with the time of the last sample).
+*/
+void monitor(Controller& controller, float rate, unsigned int summary, bool raw)
+{
+   auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double>(1.0 / rate));
+   signal(SIGINT, monitor_int_handler);
+
+   unsigned int count = 0;
+   degrees first = 0, minimum = 0, maximum = 0;
+   double sum = 0;
+   auto next = std::chrono::steady_clock::now();
+   while (!monitorInterrupted)
+   {
+      CookedAngle cooked = controller.getCookedAngle();
+      auto time = std::chrono::system_clock::now();
+      degrees angle = (raw ? controller.getLastRawAngle().val
+                           : UserAngle(cooked).val);
+
+      if (summary == 0)
+      {
+         printTimestamp(time);
+         printf(" %.3f\n", angle);
+         fflush(stdout);
+      }
+      else
+      {
+         // Raw angles can wrap around; keep the values of a block within
+         // 180 degrees of its first value.
+         if (count == 0)
+            first = minimum = maximum = angle;
+         angle = first + mod360(angle - first + 180.0) - 180.0;
+         minimum = std::min(minimum, angle);
+         maximum = std::max(maximum, angle);
+         sum += angle;
+
+         if (++count == summary)
+         {
+            degrees mean = sum / count;
+            if (raw)
+            {
+               minimum = mod360(minimum);
+               maximum = mod360(maximum);
+               mean = mod360(mean);
+            }
+            printTimestamp(time);
+            printf(" %.3f %.3f %.3f\n", minimum, maximum, mean);
+            fflush(stdout);
+            count = 0;
+            sum = 0;
+         }
+      }
+
+      // Keep to the schedule; if we fell behind, skip the missed samples
+      // rather than rushing to catch up.
+      next += period;
+      auto now = std::chrono::steady_clock::now();
+      if (next < now)
+         next = now;
+      std::this_thread::sleep_until(next);
+   }
+   signal(SIGINT, SIG_DFL);
+}
+
 int main(int argc, char *argv[])
 {
    ReturnValue retval = ReturnValue::Success;
@@ -42,6 +148,22 @@ int main(int argc, char *argv[])
       TCLAP::SwitchArg arg_queryAngle("q", "query-angle", "Query angle");
       TCLAP::SwitchArg arg_queryRawAngle("r", "raw-angle", "Query raw angle");
       TCLAP::SwitchArg arg_park("", "park", "Slew to park position");
+      TCLAP::ValueArg<unsigned int> arg_calibrate("", "calibrate",
+         "Determine the linearization coefficients up to the given harmonic "
+         "order by sweeping the axis against a reference encoder (or by using "
+         "a reference table, see --reference)", false, 0, "order");
+      TCLAP::SwitchArg arg_identify("", "identify",
+         "Determine the motor model by moving the axis with various duty "
+         "cycles and write it to the model file (see the configuration file)");
+      TCLAP::ValueArg<float> arg_monitor("", "monitor",
+         "Keep printing '<time> <angle>' lines at the given rate in Hz until "
+         "interrupted", false, 1, "rate");
+      TCLAP::SwitchArg arg_history("", "history",
+         "Print the weekly trends of the slews recorded in the history file "
+         "(see the configuration file)");
+      TCLAP::ValueArg<degrees> arg_estimate("", "estimate",
+         "Print the predicted duration of a slew to the given angle and its "
+         "uncertainty (standard deviation), both in seconds", false, 0, "angle");
       TCLAP::UnlabeledValueArg<degrees> arg_targetAngle(
          "angle", "Slew to this angle", false, 0, "target angle");
 
@@ -49,6 +171,11 @@ int main(int argc, char *argv[])
          &arg_queryAngle,
          &arg_queryRawAngle,
          &arg_park,
+         &arg_calibrate,
+         &arg_identify,
+         &arg_monitor,
+         &arg_history,
+         &arg_estimate,
          &arg_targetAngle};
 
       cmd.xorAdd(xorArgs);
@@ -59,6 +186,36 @@ int main(int argc, char *argv[])
       );
       cmd.add(arg_percentOutput);
 
+      TCLAP::SwitchArg arg_stats("", "stats",
+         "Measure the latencies of the control loop stages and print them out "
+         "at the end (or whenever SIGUSR1 is received)");
+      cmd.add(arg_stats);
+
+      TCLAP::ValueArg<std::string> arg_reference("", "reference",
+         "Calibrate from a file with '<raw angle> <reference angle>' lines "
+         "instead of performing a calibration sweep", false, "", "filename");
+      cmd.add(arg_reference);
+
+      TCLAP::SwitchArg arg_monitorRaw("", "monitor-raw",
+         "With --monitor, report raw angles instead of user angles");
+      cmd.add(arg_monitorRaw);
+
+      TCLAP::ValueArg<unsigned int> arg_summary("", "summary",
+         "With --monitor, print '<time> <min> <max> <mean>' for every N "
+         "samples instead of the samples themselves", false, 0, "N");
+      cmd.add(arg_summary);
+
+      TCLAP::ValueArg<float> arg_status("", "status",
+         "Instead of the progress indicator, output the controller status as "
+         "JSON lines at the given rate in Hz (0 means every control loop "
+         "iteration)", false, 0, "rate");
+      cmd.add(arg_status);
+
+      TCLAP::ValueArg<std::string> arg_statusSocket("", "status-socket",
+         "Serve the controller status as JSON lines to clients connecting to "
+         "this Unix socket", false, "", "path");
+      cmd.add(arg_statusSocket);
+
       // Parse the command line arguments.
       cmd.parse(argc, argv);
 
@@ -67,42 +224,170 @@ int main(int argc, char *argv[])
       // Initialize the controller parameters from the configuration file.
       try
       {
-         cparams = ControllerParams(configFilename);
+         cparams = loadControllerParams(configFilename);
          if (arg_percentOutput.isSet() || !isatty(fileno(stdout)))
             cparams.indicatorStyle = ControllerParams::IndicatorStyle::Percent;
+         if (arg_status.isSet())
+            cparams.indicatorStyle = ControllerParams::IndicatorStyle::None;
       }
-      catch (libconfig::FileIOException& e)
+      catch (ConfigFileException& e)
       {
-         std::cerr << "config file: could not read '" << configFilename << "'\n";
+         std::cerr << "config file: " << e.message << "\n";
          throw ReturnValue::ConfigError;
       }
-      catch (libconfig::ParseException& e)
+
+      if (arg_calibrate.isSet() && arg_calibrate.getValue() == 0)
       {
-         std::cerr << "config file: error parsing '" << e.getFile()
-                  << "', line " << e.getLine()
-                  << ": " << e.getError() << std::endl;
+         std::cerr << "The calibration order must be at least 1.\n";
          throw ReturnValue::ConfigError;
       }
-      catch (libconfig::SettingTypeException& e)
+
+      if (arg_identify.isSet() && cparams.modelFile.empty())
       {
-         std::cerr << "config file: wrong argument type for setting '" << e.getPath() << "'\n";
+         std::cerr << "No model file is set in the configuration file (motor.model).\n";
          throw ReturnValue::ConfigError;
       }
-      catch (libconfig::SettingNotFoundException& e)
+
+      if (arg_monitor.isSet() &&
+          (arg_monitor.getValue() <= 0 || arg_monitor.getValue() > 1000))
       {
-         std::cerr << "config file: could not find setting '" << e.getPath() << "'\n";
+         std::cerr << "The monitoring rate must be above 0 and at most 1000 Hz.\n";
          throw ReturnValue::ConfigError;
       }
-      catch (ConfigFileException& e)
+
+      if (arg_calibrate.isSet() && arg_reference.isSet())
       {
-         std::cerr << "config file: " << e.message << "\n";
-         throw ReturnValue::ConfigError;
+         // Calibration from a reference table: no hardware is involved. The
+         // table is read twice, once to fit and once to check the result.
+         HarmonicFit fit(arg_calibrate.getValue());
+         ResidualStats check;
+         try
+         {
+            std::ifstream table(arg_reference.getValue());
+            if (!table)
+            {
+               std::cerr << "could not read '" << arg_reference.getValue() << "'\n";
+               throw ReturnValue::ConfigError;
+            }
+            fitReferenceTable(table, fit);
+            if (!fit.solve())
+            {
+               std::cerr << "The reference table does not determine the coefficients.\n";
+               throw ReturnValue::CalibrationError;
+            }
+            table.clear();
+            table.seekg(0);
+            checkReferenceTable(table, fit, check);
+         }
+         catch (CalibrationException& e)
+         {
+            std::cerr << e.message << "\n";
+            throw ReturnValue::CalibrationError;
+         }
+         reportCalibration(fit, check);
+         throw ReturnValue::Success;
+      }
+
+      if (arg_history.isSet())
+      {
+         // The history is just a file; no hardware is involved.
+         if (cparams.historyFile.empty())
+         {
+            std::cerr << "No history file is set in the configuration file (history.file).\n";
+            throw ReturnValue::ConfigError;
+         }
+         if (!reportHistory(cparams.historyFile.c_str(), stdout))
+         {
+            if (errno)
+               perror(cparams.historyFile.c_str());
+            else
+               std::cerr << "'" << cparams.historyFile << "' is not a slew history file.\n";
+            throw ReturnValue::ConfigError;
+         }
+         throw ReturnValue::Success;
+      }
+
+      if (arg_queryAngle.isSet() || arg_queryRawAngle.isSet())
+      {
+         // If another mcontrol is slewing at the moment, it publishes the
+         // angle in shared memory. Take it from there instead of competing
+         // for the sensor.
+         SharedStatusReader sharedStatus;
+         StatusSnapshot status;
+         if (sharedStatus.open() && sharedStatus.read(status))
+         {
+            if (arg_queryRawAngle.isSet())
+               std::cout << status.rawAngle << std::endl;
+            else
+               std::cout << status.userAngle << std::endl;
+            throw ReturnValue::Success;
+         }
       }
 
       // Establish a controller with the parameters obtained above.
       Controller controller(cparams);
 
-      if (arg_targetAngle.isSet())
+      SlewStatistics statistics;
+      if (arg_stats.isSet())
+      {
+         controller.setStatistics(&statistics);
+         reportStatisticsOnSignal();
+      }
+
+      // Anything that moves the axis publishes its status in shared memory.
+      SharedStatusWriter sharedStatus;
+      StatusPublisher statusPublisher;
+      if (!arg_queryAngle.isSet() && !arg_queryRawAngle.isSet() &&
+          !arg_monitor.isSet() && !arg_estimate.isSet())
+      {
+         if (sharedStatus.open())
+         {
+            statusPublisher.publishTo(sharedStatus.channel());
+            controller.setStatusPublisher(&statusPublisher);
+         }
+         else
+            perror("warning: shared status publication");
+      }
+
+      if (arg_status.isSet() || arg_statusSocket.isSet())
+      {
+         if (arg_status.isSet())
+            statusPublisher.subscribeStdout(arg_status.getValue());
+         if (arg_statusSocket.isSet() &&
+             !statusPublisher.listen(arg_statusSocket.getValue()))
+         {
+            perror(arg_statusSocket.getValue().c_str());
+            throw ReturnValue::ConfigError;
+         }
+         controller.setStatusPublisher(&statusPublisher);
+         statusPublisher.start();
+      }
+
+      if (arg_calibrate.isSet())
+      {
+         // A calibration sweep against the reference encoder.
+         HarmonicFit fit(arg_calibrate.getValue());
+         ResidualStats check;
+         retval = controller.calibrationSweep(fit, check);
+         if (retval == ReturnValue::Success)
+            reportCalibration(fit, check);
+      }
+      else if (arg_identify.isSet())
+      {
+         MotorModel model;
+         retval = controller.identify(model);
+         if (retval == ReturnValue::Success)
+         {
+            if (!model.save(cparams.modelFile.c_str()))
+            {
+               perror(cparams.modelFile.c_str());
+               throw ReturnValue::ConfigError;
+            }
+            printf("breakaway duty cycle: %.0f %%\n", model.breakawayDuty);
+            printf("model written to '%s'\n", cparams.modelFile.c_str());
+         }
+      }
+      else if (arg_targetAngle.isSet())
       {
          // A slew is requested. Test whether the angle is within the safe limits
          // and perform the slew if everything seems OK.
@@ -119,6 +404,41 @@ int main(int argc, char *argv[])
          }
          retval = controller.slew(CookedAngle(targetAngle));
       }
+      else if (arg_monitor.isSet())
+      {
+         monitor(controller, arg_monitor.getValue(), arg_summary.getValue(),
+                 arg_monitorRaw.isSet());
+      }
+      else if (arg_estimate.isSet())
+      {
+         UserAngle targetAngle(arg_estimate.getValue());
+         if (!targetAngle.isSafe())
+         {
+            std::cerr << "Target angle " << targetAngle.val
+                        << " is not within safe limits.\n";
+            throw(ReturnValue::ConfigError);
+         }
+
+         // During a slew of another mcontrol, start from the angle that it
+         // publishes instead of competing for the sensor.
+         SharedStatusReader otherSlew;
+         StatusSnapshot status;
+         CookedAngle currentAngle(0);
+         if (otherSlew.open() && otherSlew.read(status))
+            currentAngle = CookedAngle(status.cookedAngle);
+         else
+            currentAngle = controller.getCookedAngle();
+
+         SlewEstimate estimate;
+         if (!controller.estimateSlew(currentAngle, CookedAngle(targetAngle),
+                                      estimate))
+         {
+            std::cerr << "There is neither a motor model (see --identify) nor "
+                         "a slew history to go by.\n";
+            throw(ReturnValue::ConfigError);
+         }
+         printf("%.2f %.2f\n", estimate.duration, estimate.uncertainty);
+      }
       else if (arg_park.isSet())
       {
          // A slew to the park position is requested. No need to test the safety
@@ -138,11 +458,25 @@ int main(int argc, char *argv[])
 
          std::cout << angle << std::endl;
       }
+      statusPublisher.stop();
+
+      if (arg_stats.isSet())
+         statistics.print(stderr);
    }
    catch (ReturnValue rv)
    {
       retval = rv;
    }
+   catch (HardwareException& e)
+   {
+      std::cerr << e.message << "\n";
+      retval = ReturnValue::HardwareError;
+   }
+   catch (std::system_error& e)
+   {
+      std::cerr << e.what() << "\n";
+      retval = ReturnValue::HardwareError;
+   }
 
    return static_cast<int>(retval);
 }
@@ -0,0 +1,473 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include "controller.h"
+#include "mcontrol.h"
+
+static_assert(MCONTROL_SAFETY_TRIP == (int)ReturnValue::SafetyTrip,
+              "the C API return values must match ReturnValue");
+static_assert(MCONTROL_PHASE_DECELERATING == (int)SlewPhase::decelerating,
+              "the C API phases must match SlewPhase");
+static_assert(MCONTROL_MOTOR_WRONG_DIRECTION == (int)MotorStatus::WrongDirection,
+              "the C API motor states must match MotorStatus");
+static_assert(MCONTROL_FAULT_SAFETY_TRIP == (int)Fault::SafetyTrip,
+              "the C API faults must match Fault");
+
+struct mcontrol
+{
+   mcontrol(const ControllerParams& params) : controller(params)
+   {
+      controller.setSignalHandling(false);
+   }
+
+   // The slew in progress (or the latest one). Guarded by slewMutex, so
+   // that mcontrol_poll() and mcontrol_stop() can take a reference to it
+   // from any thread.
+   std::shared_ptr<SlewHandle> currentSlew()
+   {
+      std::lock_guard<std::mutex> lock(slewMutex);
+      return slew;
+   }
+
+   Controller controller;
+   std::mutex slewMutex;
+   std::shared_ptr<SlewHandle> slew;
+   mcontrol_callback progressCallback = nullptr;
+   mcontrol_callback completionCallback = nullptr;
+   void* callbackData = nullptr;
+};
+
+// Only one controller can be open at a time.
+static std::mutex openMutex;
+static mcontrol* openController = nullptr;
+
+static thread_local std::string lastError;
+
+
+static int fail(int code, const char* message)
+{
+   lastError = message;
+   return code;
+}
+
+
+// Exceptions must not cross into the C code: they end up as return values,
+// with the message in lastError.
+template <typename Function>
+static int guarded(Function function)
+{
+   try
+   {
+      return function();
+   }
+   catch (ConfigFileException& e)
+   {
+      lastError = "config file: " + e.message;
+      return MCONTROL_CONFIG_ERROR;
+   }
+   catch (HardwareException& e)
+   {
+      return fail(MCONTROL_HARDWARE_ERROR, e.message.c_str());
+   }
+   catch (std::system_error& e)
+   {
+      return fail(MCONTROL_HARDWARE_ERROR, e.what());
+   }
+   catch (std::exception& e)
+   {
+      return fail(MCONTROL_INTERNAL_ERROR, e.what());
+   }
+   catch (...)
+   {
+      return fail(MCONTROL_INTERNAL_ERROR, "unknown exception");
+   }
+}
+
+
+// Read (but do not apply) the parameters.
+static bool readParams(const char* configFile, ControllerParams& params)
+{
+   if (!configFile)
+   {
+      lastError = "no configuration file given";
+      return false;
+   }
+   try
+   {
+      params = readControllerParams(configFile);
+   }
+   catch (ConfigFileException& e)
+   {
+      lastError = "config file: " + e.message;
+      return false;
+   }
+   params.indicatorStyle = ControllerParams::IndicatorStyle::None;
+   return true;
+}
+
+
+static void fillStatus(const StatusSnapshot& snapshot, bool slewing,
+                       int result, mcontrol_status* status)
+{
+   status->tick = snapshot.tick;
+   status->timestamp = snapshot.timestamp;
+   status->user_angle = snapshot.userAngle;
+   status->cooked_angle = snapshot.cookedAngle;
+   status->raw_angle = snapshot.rawAngle;
+   status->velocity = snapshot.velocity;
+   status->duty = snapshot.duty;
+   status->phase = (int)snapshot.phase;
+   status->motor_status = (int)snapshot.motorStatus;
+   status->fault = (int)snapshot.fault;
+   status->slewing = slewing;
+   status->result = result;
+}
+
+
+// Whether the slew is still in progress; the outcome of a finished one is
+// stored into result.
+static bool slewing(const std::shared_ptr<SlewHandle>& slew, int* result)
+{
+   ReturnValue outcome = ReturnValue::Success;
+   bool finished = !slew || slew->poll(&outcome);
+   *result = (int)outcome;
+   return !finished;
+}
+
+
+static int startSlew(mcontrol* handle, CookedAngle target)
+{
+   int result;
+   if (slewing(handle->currentSlew(), &result))
+      return fail(MCONTROL_BUSY, "a slew is in progress");
+
+   SlewHandle::ProgressCallback progress;
+   SlewHandle::CompletionCallback completion;
+   mcontrol_callback progressCallback = handle->progressCallback;
+   mcontrol_callback completionCallback = handle->completionCallback;
+   void* data = handle->callbackData;
+   Controller& controller = handle->controller;
+
+   if (progressCallback)
+      progress = [progressCallback, data, result](const StatusSnapshot& snapshot)
+         {
+            mcontrol_status status;
+            fillStatus(snapshot, true, result, &status);
+            progressCallback(&status, data);
+         };
+   if (completionCallback)
+      completion = [completionCallback, data, &controller](ReturnValue outcome)
+         {
+            mcontrol_status status;
+            fillStatus(controller.currentStatus(), false, (int)outcome, &status);
+            completionCallback(&status, data);
+         };
+
+   std::unique_ptr<SlewHandle> slew =
+      controller.slewAsync(target, progress, completion);
+   if (!slew)
+      return fail(MCONTROL_BUSY, "a slew is in progress");
+
+   // The previous handle has finished already, so releasing it (outside
+   // the lock) does not block.
+   std::shared_ptr<SlewHandle> previous;
+   {
+      std::lock_guard<std::mutex> lock(handle->slewMutex);
+      previous = std::move(handle->slew);
+      handle->slew = std::move(slew);
+   }
+   return MCONTROL_OK;
+}
+
+
+extern "C" {
+
+int mcontrol_api_version(void)
+{
+   return MCONTROL_API_VERSION;
+}
+
+
+const char* mcontrol_last_error(void)
+{
+   return lastError.c_str();
+}
+
+
+mcontrol* mcontrol_open(const char* configFile)
+{
+   mcontrol* handle = nullptr;
+   guarded([&]() -> int
+      {
+         std::lock_guard<std::mutex> lock(openMutex);
+         if (openController)
+            return fail(MCONTROL_BUSY, "the controller is already open");
+
+         ControllerParams params;
+         if (!readParams(configFile, params))
+            return MCONTROL_CONFIG_ERROR;
+
+         // Put the angle scales of the file in effect only along with a
+         // controller that uses them.
+         AngleScales previous = AngleScales::current();
+         params.angleScales.apply();
+         try
+         {
+            handle = new mcontrol(params);
+         }
+         catch (...)
+         {
+            previous.apply();
+            throw;
+         }
+         openController = handle;
+         return MCONTROL_OK;
+      });
+   return handle;
+}
+
+
+void mcontrol_close(mcontrol* handle)
+{
+   if (!handle)
+      return;
+
+   guarded([handle]() -> int
+      {
+         mcontrol_stop(handle, 1);
+         {
+            // Destroying the handle waits for the slew (and the callbacks)
+            // to finish, which must happen outside the lock: the callbacks
+            // may call mcontrol_poll() or mcontrol_stop().
+            std::shared_ptr<SlewHandle> slew;
+            {
+               std::lock_guard<std::mutex> lock(handle->slewMutex);
+               slew = std::move(handle->slew);
+            }
+         }
+
+         std::lock_guard<std::mutex> lock(openMutex);
+         delete handle;
+         openController = nullptr;
+         return MCONTROL_OK;
+      });
+}
+
+
+int mcontrol_configure(mcontrol* handle, const char* configFile)
+{
+   if (!handle)
+      return fail(MCONTROL_INVALID_ARGUMENT, "no controller");
+
+   return guarded([handle, configFile]() -> int
+      {
+         int result;
+         if (slewing(handle->currentSlew(), &result))
+            return fail(MCONTROL_BUSY, "a slew is in progress");
+
+         // Everything is read and checked before anything changes, so that
+         // a configuration that can not be used leaves the previous one in
+         // effect.
+         ControllerParams params;
+         if (!readParams(configFile, params))
+            return MCONTROL_CONFIG_ERROR;
+         AngleScales previous = AngleScales::current();
+         params.angleScales.apply();
+         try
+         {
+            handle->controller.setParams(params);
+         }
+         catch (...)
+         {
+            previous.apply();
+            throw;
+         }
+         return MCONTROL_OK;
+      });
+}
+
+
+int mcontrol_set_callbacks(mcontrol* handle, mcontrol_callback progress,
+                           mcontrol_callback completion, void* userData)
+{
+   if (!handle)
+      return fail(MCONTROL_INVALID_ARGUMENT, "no controller");
+
+   return guarded([=]() -> int
+      {
+         int result;
+         if (slewing(handle->currentSlew(), &result))
+            return fail(MCONTROL_BUSY, "a slew is in progress");
+
+         handle->progressCallback = progress;
+         handle->completionCallback = completion;
+         handle->callbackData = userData;
+         return MCONTROL_OK;
+      });
+}
+
+
+int mcontrol_query(mcontrol* handle, double* userAngle, double* rawAngle)
+{
+   if (!handle)
+      return fail(MCONTROL_INVALID_ARGUMENT, "no controller");
+
+   return guarded([=]() -> int
+      {
+         int result;
+         if (slewing(handle->currentSlew(), &result))
+         {
+            // The control loop owns the sensor; take its latest measurement.
+            StatusSnapshot status = handle->controller.currentStatus();
+            if (userAngle)
+               *userAngle = status.userAngle;
+            if (rawAngle)
+               *rawAngle = status.rawAngle;
+            return MCONTROL_OK;
+         }
+
+         if (userAngle)
+            *userAngle = handle->controller.getUserAngle().val;
+         if (rawAngle)
+            *rawAngle = handle->controller.getRawAngle().val;
+         return MCONTROL_OK;
+      });
+}
+
+
+int mcontrol_slew(mcontrol* handle, double userAngle)
+{
+   if (!handle)
+      return fail(MCONTROL_INVALID_ARGUMENT, "no controller");
+
+   UserAngle target(userAngle);
+   if (!target.isSafe())
+      return fail(MCONTROL_UNSAFE_ANGLE, "target angle is not within safe limits");
+   return guarded([=] { return startSlew(handle, CookedAngle(target)); });
+}
+
+
+int mcontrol_park(mcontrol* handle)
+{
+   if (!handle)
+      return fail(MCONTROL_INVALID_ARGUMENT, "no controller");
+   return guarded([handle]() -> int
+      {
+         return startSlew(handle, handle->controller.getParams().parkPosition);
+      });
+}
+
+
+int mcontrol_poll(mcontrol* handle, mcontrol_status* status)
+{
+   if (!handle || !status)
+      return 0;
+
+   // Check the handle first: if the slew finishes in the meantime, the
+   // snapshot is only more recent than that. Should anything fail, report
+   // no slew in progress (the error is in mcontrol_last_error()).
+   bool inProgress = false;
+   guarded([&]() -> int
+      {
+         int result;
+         inProgress = slewing(handle->currentSlew(), &result);
+         fillStatus(handle->controller.currentStatus(), inProgress, result, status);
+         return MCONTROL_OK;
+      });
+   return inProgress;
+}
+
+
+int mcontrol_wait(mcontrol* handle)
+{
+   if (!handle)
+      return fail(MCONTROL_INVALID_ARGUMENT, "no controller");
+
+   return guarded([handle]() -> int
+      {
+         std::shared_ptr<SlewHandle> slew = handle->currentSlew();
+         return (slew ? (int)slew->wait() : MCONTROL_OK);
+      });
+}
+
+
+int mcontrol_stop(mcontrol* handle, int immediate)
+{
+   if (!handle)
+      return fail(MCONTROL_INVALID_ARGUMENT, "no controller");
+
+   return guarded([=]() -> int
+      {
+         std::shared_ptr<SlewHandle> slew = handle->currentSlew();
+         if (slew)
+            slew->cancel(immediate ? SlewHandle::Cancel::Immediate
+                                   : SlewHandle::Cancel::Graceful);
+         return MCONTROL_OK;
+      });
+}
+
+
+int mcontrol_estimate(mcontrol* handle, double fromAngle, double toAngle,
+                      double* duration, double* uncertainty)
+{
+   if (!handle)
+      return fail(MCONTROL_INVALID_ARGUMENT, "no controller");
+
+   UserAngle target(toAngle);
+   if (!target.isSafe())
+      return fail(MCONTROL_UNSAFE_ANGLE, "target angle is not within safe limits");
+
+   return guarded([=]() -> int
+      {
+         SlewEstimate estimate;
+         if (!handle->controller.estimateSlew(CookedAngle(UserAngle(fromAngle)),
+                                              CookedAngle(target), estimate))
+            return fail(MCONTROL_CONFIG_ERROR,
+                        "there is neither a motor model nor a slew history");
+         if (duration)
+            *duration = estimate.duration;
+         if (uncertainty)
+            *uncertainty = estimate.uncertainty;
+         return MCONTROL_OK;
+      });
+}
+
+
+int mcontrol_reset(mcontrol* handle)
+{
+   if (!handle)
+      return fail(MCONTROL_INVALID_ARGUMENT, "no controller");
+
+   return guarded([handle]() -> int
+      {
+         int result;
+         if (slewing(handle->currentSlew(), &result))
+            return fail(MCONTROL_BUSY, "a slew is in progress");
+
+         handle->controller.resetSafetyTrip();
+         return MCONTROL_OK;
+      });
+}
+
+} // extern "C"
@@ -0,0 +1,182 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MCONTROL_H
+#define MCONTROL_H
+
+#include <stdint.h>
+
+/* The C interface of libmcontrol.
+ *
+ * This is meant for programs that control the axis themselves (from C or
+ * through a foreign function interface, e.g. Python's ctypes) instead of
+ * running the mcontrol program for every operation. The interface only
+ * uses plain C types and is kept binary compatible within the same
+ * MCONTROL_API_VERSION.
+ *
+ * Only one controller can be open in a process at a time, as there is only
+ * one axis (and one set of angle scales). The functions of one controller
+ * must not be called concurrently, except for mcontrol_poll() and
+ * mcontrol_stop(), which can be called from any thread at any time (and
+ * from the callbacks). Unlike
+ * the mcontrol program, the library does not touch the signal handlers.
+ *
+ * Angles are user angles (see the configuration file), unless noted
+ * otherwise.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MCONTROL_API_VERSION 4
+
+/* Return values. The values up to MCONTROL_SAFETY_TRIP are the same
+ * as the exit codes of the mcontrol program. */
+enum
+{
+   MCONTROL_OK = 0,
+   MCONTROL_CONFIG_ERROR = 1,
+   MCONTROL_HARDWARE_ERROR = 2,
+   MCONTROL_STALL = 3,
+   MCONTROL_SLEW_NOT_FINISHED = 4,
+   MCONTROL_CALIBRATION_ERROR = 5,
+   MCONTROL_SAFETY_TRIP = 6,       /* the safety watchdog has tripped */
+   MCONTROL_BUSY = 100,            /* a slew is in progress */
+   MCONTROL_UNSAFE_ANGLE = 101,    /* outside the safe slew limits */
+   MCONTROL_INVALID_ARGUMENT = 102,
+   MCONTROL_INTERNAL_ERROR = 103   /* unexpected failure; since version 4 */
+};
+
+enum
+{
+   MCONTROL_PHASE_IDLE,
+   MCONTROL_PHASE_ACCELERATING,
+   MCONTROL_PHASE_PLATEAU,
+   MCONTROL_PHASE_DECELERATING
+};
+
+enum
+{
+   MCONTROL_MOTOR_UNDETERMINED,
+   MCONTROL_MOTOR_OK,
+   MCONTROL_MOTOR_STALLED,
+   MCONTROL_MOTOR_WRONG_DIRECTION
+};
+
+enum
+{
+   MCONTROL_FAULT_NONE,
+   MCONTROL_FAULT_STALL,
+   MCONTROL_FAULT_WRONG_DIRECTION,
+   MCONTROL_FAULT_INTERRUPTED,
+   MCONTROL_FAULT_EMERGENCY_STOP,
+   MCONTROL_FAULT_SAFETY_TRIP
+};
+
+typedef struct mcontrol mcontrol;
+
+typedef struct mcontrol_status
+{
+   uint64_t tick;          /* control loop iteration (0: no slew yet) */
+   int64_t timestamp;      /* nanoseconds since the epoch */
+   double user_angle;
+   double cooked_angle;
+   double raw_angle;
+   double velocity;        /* degrees per second */
+   double duty;            /* percent */
+   int phase;              /* MCONTROL_PHASE_... */
+   int motor_status;       /* MCONTROL_MOTOR_... */
+   int fault;              /* MCONTROL_FAULT_... of the latest slew */
+   int slewing;            /* nonzero while a slew is in progress */
+   int result;             /* outcome of the latest finished slew */
+} mcontrol_status;
+
+/* A callback with the status of a slew (see mcontrol_set_callbacks()). */
+typedef void (*mcontrol_callback)(const mcontrol_status* status, void* user_data);
+
+/* The MCONTROL_API_VERSION that the library was built with. */
+int mcontrol_api_version(void);
+
+/* A description of the latest error in the calling thread. */
+const char* mcontrol_last_error(void);
+
+/* Open the controller with the parameters from the given configuration
+ * file. Returns null on failure, including a failure to initialize the
+ * hardware (before version 4, that terminated the process). */
+mcontrol* mcontrol_open(const char* config_file);
+
+/* Stop any slew immediately and release the controller. */
+void mcontrol_close(mcontrol* controller);
+
+/* Reread the configuration file. Not possible during a slew. If the file
+ * can not be used, the previous configuration stays in effect. */
+int mcontrol_configure(mcontrol* controller, const char* config_file);
+
+/* Set the callbacks for the following slews (either may be null). They are
+ * called from a thread of the library: progress with the latest status
+ * about ten times per second and once more at the end of the slew, then
+ * completion once with the final status, including the outcome. Not
+ * possible during a slew. The callbacks must not start or wait for
+ * slews. Since version 2. */
+int mcontrol_set_callbacks(mcontrol* controller, mcontrol_callback progress,
+                           mcontrol_callback completion, void* user_data);
+
+/* The current angle (either pointer may be null). During a slew, the
+ * latest angle measured by the control loop is reported. */
+int mcontrol_query(mcontrol* controller, double* user_angle, double* raw_angle);
+
+/* Start a slew to the given angle (or the park position) and return
+ * immediately. Use mcontrol_poll() or mcontrol_wait() to follow it. */
+int mcontrol_slew(mcontrol* controller, double user_angle);
+int mcontrol_park(mcontrol* controller);
+
+/* Fill in the status. Returns nonzero while a slew is in progress. */
+int mcontrol_poll(mcontrol* controller, mcontrol_status* status);
+
+/* Wait for the slew in progress (if any) to finish and return its
+ * outcome. */
+int mcontrol_wait(mcontrol* controller);
+
+/* Stop the slew in progress: gracefully (decelerating as usual) or, with
+ * nonzero immediate, by cutting the power right away. Does not wait for the
+ * axis to stop. */
+int mcontrol_stop(mcontrol* controller, int immediate);
+
+/* Predict the duration of a slew between the given angles (the start
+ * usually being the current angle from mcontrol_query()) and its
+ * uncertainty (standard deviation), both in seconds; either pointer may be
+ * null. The prediction comes from the motor model and the slew history,
+ * takes well under a microsecond and does not touch the hardware, so it
+ * can be made for many candidate targets, also during a slew. Returns
+ * MCONTROL_CONFIG_ERROR if there is neither a model nor any history to go
+ * by. Since version 3. */
+int mcontrol_estimate(mcontrol* controller, double from_angle, double to_angle,
+                      double* duration, double* uncertainty);
+
+/* Clear a trip of the safety watchdog, which otherwise prevents any
+ * further slews. Find out what went wrong first! */
+int mcontrol_reset(mcontrol* controller);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MCONTROL_H */
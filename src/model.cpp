@@ -0,0 +1,131 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <libconfig.h++>
+#include "model.h"
+
+/* Linear interpolation of y(x) over the points, x increasing. */
+template <class X, class Y>
+static float interpolate(const std::vector<MotorModel::Point>& points,
+                         X x, Y y, float value)
+{
+   if (points.empty())
+      return 0;
+   if (value <= x(points.front()))
+      return y(points.front());
+   if (value >= x(points.back()))
+      return y(points.back());
+
+   unsigned int i = 1;
+   while (x(points[i]) < value)
+      i++;
+   const MotorModel::Point& a = points[i - 1];
+   const MotorModel::Point& b = points[i];
+   if (x(b) == x(a))
+      return y(b);
+   return y(a) + (y(b) - y(a)) * (value - x(a)) / (x(b) - x(a));
+}
+
+
+float MotorModel::velocityAt(float duty) const
+{
+   return interpolate(points, [](const Point& p) { return p.duty; },
+                      [](const Point& p) { return p.velocity; }, duty);
+}
+
+
+float MotorModel::dutyFor(float velocity) const
+{
+   return interpolate(points, [](const Point& p) { return p.velocity; },
+                      [](const Point& p) { return p.duty; }, velocity);
+}
+
+
+float MotorModel::timeConstantAt(float duty) const
+{
+   return interpolate(points, [](const Point& p) { return p.duty; },
+                      [](const Point& p) { return p.timeConstant; }, duty);
+}
+
+
+void MotorModel::makeMonotonic()
+{
+   for (unsigned int i = 1; i < points.size(); i++)
+      points[i].velocity = std::max(points[i].velocity, points[i - 1].velocity);
+}
+
+
+bool MotorModel::load(const char* filename)
+{
+   libconfig::Config model;
+   model.setAutoConvert(true);
+   model.readFile(filename);
+
+   breakawayDuty = model.lookup("model.breakawayDuty");
+   libconfig::Setting& duty = model.lookup("model.duty");
+   libconfig::Setting& velocity = model.lookup("model.velocity");
+   libconfig::Setting& timeConstant = model.lookup("model.timeConstant");
+   if (!duty.isArray() || !velocity.isArray() || !timeConstant.isArray() ||
+       velocity.getLength() != duty.getLength() ||
+       timeConstant.getLength() != duty.getLength())
+      return false;
+
+   points.clear();
+   for (int i = 0; i < duty.getLength(); i++)
+      points.push_back({duty[i], velocity[i], timeConstant[i]});
+   std::sort(points.begin(), points.end(),
+             [](const Point& a, const Point& b) { return a.duty < b.duty; });
+   makeMonotonic();
+   return true;
+}
+
+
+bool MotorModel::save(const char* filename) const
+{
+   FILE* file = fopen(filename, "w");
+   if (!file)
+      return false;
+
+   fprintf(file,
+      "// Motor model, written by \"mcontrol --identify\". Steady velocities\n"
+      "// (degrees per second) and time constants (seconds) at the given PWM\n"
+      "// duty cycles.\n"
+      "model:\n{\n"
+      "   breakawayDuty = %.1f\n", breakawayDuty);
+
+   auto writeArray = [&](const char* name, float Point::*field, const char* format)
+      {
+         fprintf(file, "   %s = [", name);
+         for (unsigned int i = 0; i < points.size(); i++)
+         {
+            fprintf(file, (i ? ", " : " "));
+            fprintf(file, format, points[i].*field);
+         }
+         fprintf(file, " ]\n");
+      };
+   writeArray("duty", &Point::duty, "%.1f");
+   writeArray("velocity", &Point::velocity, "%.4f");
+   writeArray("timeConstant", &Point::timeConstant, "%.4f");
+   fprintf(file, "}\n");
+
+   return (fclose(file) == 0);
+}
@@ -0,0 +1,67 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MODEL_H
+#define MODEL_H
+
+#include <vector>
+
+/* A model of the motor driving the axis, as determined by "mcontrol
+ * --identify": the steady velocity as a function of the PWM duty cycle
+ * (piecewise linear between the measured points, zero in the dead zone)
+ * and the time constant of the first-order lag with which the velocity
+ * follows the duty. The controller uses it as a feedforward: it commands
+ * the duty that gives the wanted velocity right away.
+*/
+struct MotorModel
+{
+   struct Point
+   {
+      float duty;            // percent
+      float velocity;        // degrees per second
+      float timeConstant;    // seconds
+   };
+
+   inline bool valid() const { return points.size() >= 2; }
+
+   // Interpolations of the map. Outside the measured range, the nearest
+   // point applies.
+   float velocityAt(float duty) const;
+   float dutyFor(float velocity) const;
+   float timeConstantAt(float duty) const;
+
+   // Make the velocities nondecreasing with the duty (as they should be,
+   // apart from the measurement errors), so that the map can be inverted.
+   void makeMonotonic();
+
+   // The model file uses the syntax of the configuration file. load()
+   // throws the libconfig exceptions and returns false if the arrays do not
+   // match; save() returns false on failure (see errno).
+   bool load(const char* filename);
+   bool save(const char* filename) const;
+
+   // The duty needed to get the axis going from standstill.
+   float breakawayDuty = 0;
+
+   // Measured points, in the order of increasing duty.
+   std::vector<Point> points;
+};
+
+#endif // MODEL_H
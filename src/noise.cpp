@@ -0,0 +1,95 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include "noise.h"
+
+const uint64_t SensorNoise::window;
+
+void SensorNoise::update(const degrees* sorted, unsigned int count,
+                         degrees filtered)
+{
+   degrees threshold = spikeThreshold();
+   unsigned int kept = 0;
+   for (unsigned int i = 0; i < count; i++)
+      if (std::abs(sorted[i] - filtered) <= threshold)
+         kept++;
+
+   // The deviations from the filtered value are smaller than the ones from
+   // the true angle, since the filtered value follows the readouts; the
+   // usual n/(n - 1) correction makes up for that.
+   double correction = (kept > 1 ? double(kept) / (kept - 1) : 1.0);
+
+   for (unsigned int i = 0; i < count; i++)
+   {
+      double deviation = sorted[i] - filtered;
+      bool spike = std::abs(deviation) > threshold;
+
+      readouts = std::min(readouts + 1, window);
+      spikes += ((spike ? 1.0 : 0.0) - spikes) / readouts;
+
+      if (!spike && kept > 1)
+      {
+         samples = std::min(samples + 1, window);
+         variance += (deviation * deviation * correction - variance) / samples;
+      }
+   }
+}
+
+
+unsigned int SensorNoise::readoutsFor(degrees precision, unsigned int minimum,
+                                      unsigned int maximum) const
+{
+   if (!settled())
+      return maximum;
+
+   // The error of the mean of n readouts is sigma/sqrt(n).
+   double needed = std::ceil(variance / (precision * precision));
+   unsigned int count = std::max<double>(minimum, std::min<double>(needed, maximum));
+
+   // Leave enough readouts after the trimming.
+   while (count < maximum && count < 2 * trimFor(count) + 1)
+      count++;
+   return count;
+}
+
+
+unsigned int SensorNoise::trimFor(unsigned int count) const
+{
+   // One readout at each end always goes, as the spikes can not be told
+   // apart from the noise in every single measurement. With frequent
+   // spikes, make room for twice as many as expected.
+   unsigned int trim = 1 + (unsigned int)(2 * spikes * count);
+   return std::min(trim, (count - 1) / 2);
+}
+
+
+degrees SensorNoise::spikeThreshold() const
+{
+   // Until there is a noise estimate, only the gross outliers are obvious.
+   if (!settled())
+      return 5.0;
+
+   // Otherwise, anything beyond six sigma (but at least two steps of the
+   // sensor) is a spike.
+   const degrees codeStep = 360.0 / (RawCode::mask + 1);
+   return std::max<degrees>(6 * sigma(), 2 * codeStep);
+}
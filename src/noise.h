@@ -0,0 +1,79 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NOISE_H
+#define NOISE_H
+
+#include <cmath>
+#include <cstdint>
+#include "angles.h"
+
+/* Online estimates of the sensor noise.
+ *
+ * Every angle measurement of the controller consists of several readouts
+ * that are taken in quick succession, so their spread around the filtered
+ * value is the noise of the sensor. Readouts that lie far out are counted
+ * as spikes; the rest contribute to the noise variance. Both estimates are
+ * running (Welford) means whose effective length is capped at window
+ * readouts, so that they follow slow changes of the noise.
+ *
+ * The estimates determine how many readouts a measurement needs to reach
+ * the wanted precision and how many of them to throw away at each end.
+*/
+class SensorNoise
+{
+public:
+   // The most readouts that a single measurement can take.
+   static const unsigned int maxReadouts = 15;
+
+   // Take the readouts of a measurement (sorted, count of them) and the
+   // filtered value into account.
+   void update(const degrees* sorted, unsigned int count, degrees filtered);
+
+   // The number of readouts, within the given bounds, that brings the error
+   // of a measurement down to precision. Until the estimates settle, the
+   // maximum is used.
+   unsigned int readoutsFor(degrees precision, unsigned int minimum,
+                            unsigned int maximum) const;
+
+   // The number of readouts to discard at each end of a sorted measurement.
+   unsigned int trimFor(unsigned int count) const;
+
+   // Standard deviation of a single readout, without the spikes.
+   inline degrees sigma() const { return std::sqrt(variance); }
+
+   // The fraction of readouts that are spikes.
+   inline double spikeRate() const { return spikes; }
+
+   inline bool settled() const { return samples >= settleSamples; }
+
+private:
+   degrees spikeThreshold() const;
+
+   static const uint64_t window = 4096;
+   static const uint64_t settleSamples = 50;
+
+   uint64_t samples = 0;
+   uint64_t readouts = 0;
+   double variance = 0;
+   double spikes = 0;
+};
+
+#endif // NOISE_H
@@ -0,0 +1,207 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <cstdarg>
+#include "eventloop.h"
+#include "output.h"
+
+const unsigned int AsyncOutput::recordLength;
+const unsigned int AsyncOutput::queueLength;
+const unsigned int AsyncOutput::freshBit;
+
+
+AsyncOutput::AsyncOutput() :
+   enqueuePosition(0), dequeuePosition(0),
+   progressShared(2), progressBack(0), progressFront(1), progressPending(false),
+   nextOrder(0), posted(0), finished(0), dropped(0),
+   running(false), stopRequested(false)
+{
+   for (unsigned int i = 0; i < queueLength; i++)
+      queue[i].sequence = i;
+}
+
+
+AsyncOutput::~AsyncOutput()
+{
+   if (running)
+   {
+      stopRequested = true;
+      wake();
+      thread.join();
+   }
+}
+
+
+void AsyncOutput::start()
+{
+   std::lock_guard<std::mutex> lock(mutex);
+   if (running)
+      return;
+   thread = std::thread(&AsyncOutput::writer, this);
+   running = true;
+}
+
+
+void AsyncOutput::message(FILE* stream, const char* format, ...)
+{
+   // Claim a slot in the queue.
+   uint64_t position = enqueuePosition.load(std::memory_order_relaxed);
+   Record* record;
+   while (true)
+   {
+      record = &queue[position % queueLength];
+      uint64_t sequence = record->sequence.load(std::memory_order_acquire);
+      int64_t difference = (int64_t)sequence - (int64_t)position;
+      if (difference == 0)
+      {
+         if (enqueuePosition.compare_exchange_weak(position, position + 1,
+                                                   std::memory_order_relaxed))
+            break;
+      }
+      else if (difference < 0)
+      {
+         // The queue is full.
+         dropped++;
+         return;
+      }
+      else
+         position = enqueuePosition.load(std::memory_order_relaxed);
+   }
+
+   record->order = nextOrder++;
+   record->stream = stream;
+   va_list args;
+   va_start(args, format);
+   vsnprintf(record->text, recordLength, format, args);
+   va_end(args);
+
+   posted++;
+   record->sequence.store(position + 1, std::memory_order_release);
+   wake();
+}
+
+
+void AsyncOutput::progress(FILE* stream, const char* format, ...)
+{
+   Record& record = progressSlots[progressBack];
+   record.order = nextOrder++;
+   record.stream = stream;
+   va_list args;
+   va_start(args, format);
+   vsnprintf(record.text, recordLength, format, args);
+   va_end(args);
+
+   posted++;
+   unsigned int previous =
+      progressShared.exchange(progressBack | freshBit, std::memory_order_acq_rel);
+   progressBack = previous & ~freshBit;
+
+   // A record that the writer has not picked up yet is now gone.
+   if (previous & freshBit)
+      finished++;
+   wake();
+}
+
+
+void AsyncOutput::flush()
+{
+   if (!running)
+      return;
+
+   wake();
+   while (finished < posted)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+
+void AsyncOutput::wake()
+{
+   // Notifying without holding the mutex can lose a wakeup, but the writer
+   // never sleeps for long anyway. Taking the mutex here could block.
+   wakeup.notify_one();
+}
+
+
+void AsyncOutput::writer()
+{
+   blockSignalsInThread();
+
+   while (true)
+   {
+      bool stopping = stopRequested;
+      while (writeNext())
+         ;
+      if (stopping)
+         break;
+
+      std::unique_lock<std::mutex> lock(mutex);
+      wakeup.wait_for(lock, std::chrono::milliseconds(20));
+   }
+}
+
+
+/* Writes out the oldest pending record. Returns false if there was none. */
+bool AsyncOutput::writeNext()
+{
+   // Pick up the newest progress record. If we still hold an older one, it
+   // has been superseded.
+   if (progressShared.load(std::memory_order_acquire) & freshBit)
+   {
+      if (progressPending)
+         finished++;
+      progressFront = progressShared.exchange(progressFront,
+                                              std::memory_order_acq_rel) & ~freshBit;
+      progressPending = true;
+   }
+
+   Record* message = &queue[dequeuePosition % queueLength];
+   if (message->sequence.load(std::memory_order_acquire) != dequeuePosition + 1)
+      message = nullptr;
+
+   if (!message && !progressPending)
+      return false;
+
+   if (message &&
+       (!progressPending || message->order < progressSlots[progressFront].order))
+   {
+      fputs(message->text, message->stream);
+      fflush(message->stream);
+      message->sequence.store(dequeuePosition + queueLength,
+                              std::memory_order_release);
+      dequeuePosition++;
+   }
+   else
+   {
+      Record& progress = progressSlots[progressFront];
+      fputs(progress.text, progress.stream);
+      fflush(progress.stream);
+      progressPending = false;
+   }
+   finished++;
+   return true;
+}
+
+
+AsyncOutput& asyncOutput()
+{
+   static AsyncOutput output;
+   return output;
+}
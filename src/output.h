@@ -0,0 +1,121 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+/* Asynchronous output.
+ *
+ * Writing to a slow terminal or to a pipe that nobody reads can block for an
+ * arbitrarily long time, and the motor would keep running at the last duty
+ * cycle meanwhile. Therefore, the control loop does not write anything
+ * itself: it formats its output into a record and leaves the writing to a
+ * separate thread. Posting a record takes no locks, makes no system calls
+ * and never blocks.
+ *
+ * There are two kinds of records:
+ *
+ * - Messages (status and error reports) go into a bounded queue. Should the
+ *   queue be full, the message is dropped (and counted).
+ *
+ * - Progress records: only the most recent one is of any interest, so a new
+ *   progress record replaces the previous one if the writer has not picked
+ *   it up yet.
+ *
+ * Records are written out in the order they were posted. Progress records
+ * are expected to come from a single thread at a time.
+*/
+class AsyncOutput
+{
+public:
+   AsyncOutput();
+   ~AsyncOutput();
+
+   // Start the writer thread (if not running yet). Posting records before
+   // that is fine, they are just not written until the thread starts.
+   void start();
+
+   // Post a message or a progress record, printf style.
+   void message(FILE* stream, const char* format, ...)
+      __attribute__((format(printf, 3, 4)));
+   void progress(FILE* stream, const char* format, ...)
+      __attribute__((format(printf, 3, 4)));
+
+   // Wait until everything posted so far is written out (or dropped).
+   void flush();
+
+   // The number of messages dropped due to a full queue.
+   inline uint64_t droppedMessages() const { return dropped; }
+
+   static const unsigned int recordLength = 256;
+   static const unsigned int queueLength = 64;
+
+private:
+   struct Record
+   {
+      std::atomic<uint64_t> sequence;
+      uint64_t order;
+      FILE* stream;
+      char text[recordLength];
+   };
+
+   void writer();
+   bool writeNext();
+   void wake();
+
+   // The message queue: a bounded multi-producer queue after D. Vyukov.
+   Record queue[queueLength];
+   std::atomic<uint64_t> enqueuePosition;
+   uint64_t dequeuePosition;
+
+   // The progress mailbox: a triple buffer. The producer owns one slot, the
+   // consumer another one and the third one is exchanged between them; the
+   // fresh bit tells the consumer that the exchanged slot holds a new record.
+   Record progressSlots[3];
+   std::atomic<unsigned int> progressShared;
+   unsigned int progressBack;
+   unsigned int progressFront;
+   bool progressPending;
+   static const unsigned int freshBit = 4;
+
+   // Ordering and accounting of the records.
+   std::atomic<uint64_t> nextOrder;
+   std::atomic<uint64_t> posted;
+   std::atomic<uint64_t> finished;
+   std::atomic<uint64_t> dropped;
+
+   std::thread thread;
+   std::mutex mutex;
+   std::condition_variable wakeup;
+   std::atomic_bool running;
+   std::atomic_bool stopRequested;
+};
+
+// The output of the program.
+AsyncOutput& asyncOutput();
+
+#endif // OUTPUT_H
@@ -0,0 +1,276 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <tclap/CmdLine.h>
+#include "controller.h"
+
+/* Control quality scenarios.
+ *
+ * A fixed catalogue of slews on the simulator: short and long ones, an
+ * initial stall that takes de-stall pulses, a noisy sensor and a slew that
+ * is stopped early (as with Ctrl+C). The sensor noise is seeded, so every
+ * run sees the same readouts; the control loop, however, runs in real time,
+ * so the results vary a little from run to run and are compared with the
+ * baselines within tolerances. Only changes for the worse count as
+ * regressions.
+*/
+
+struct Scenario
+{
+   const char* name;
+   degrees distance;             // of the target from the starting angle
+   degrees noise;                // of the sensor
+   unsigned int spikePeriod;     // of the sensor, 0 for none
+   int initialStalls;            // see SimulatedMotor::setInitialStalls()
+   std::chrono::milliseconds stopAfter;   // 0 for a full slew
+};
+
+static const Scenario scenarios[] = {
+   { "short",          2, 0.1, 233,  0, std::chrono::milliseconds(0) },
+   { "long",          25, 0.1, 233,  0, std::chrono::milliseconds(0) },
+   { "long-reverse", -25, 0.1, 233,  0, std::chrono::milliseconds(0) },
+   { "stall",        -10, 0.1, 233,  2, std::chrono::milliseconds(0) },
+   { "noisy",        -10, 0.3,  50,  0, std::chrono::milliseconds(0) },
+   { "stopped",       25, 0.1, 233,  0, std::chrono::milliseconds(4000) },
+};
+
+struct Result
+{
+   int outcome = 0;              // ReturnValue
+   double time = 0;              // seconds
+   degrees overshoot = 0;        // past the target, in the slew direction
+   degrees error = 0;            // of the final (true) angle
+   unsigned long iterations = 0; // of the control loop
+};
+
+// How much worse than the baseline a result may get.
+static bool withinTolerance(const Result& result, const Result& baseline)
+{
+   return result.outcome == baseline.outcome &&
+          result.time <= baseline.time * 1.15 + 0.3 &&
+          result.overshoot <= baseline.overshoot + 0.05 &&
+          result.error <= baseline.error + 0.1 &&
+          result.iterations <= baseline.iterations * 1.15 + 20;
+}
+
+static const uint64_t seed = 20141001;
+
+
+// The true angle of the simulated axis.
+static CookedAngle axisAngle(SimulatedMotor& motor)
+{
+   return CookedAngle(RawAngle(mod360(motor.currentAngle())));
+}
+
+
+static Result run(const Scenario& scenario, const ControllerParams& params)
+{
+   SimulatedMotor motor(30);
+   motor.setInitialStalls(scenario.initialStalls);
+   SimulatedSensor sensor(&motor, scenario.noise, scenario.spikePeriod, seed);
+   BasicController<BackendMotor, BackendSensor> controller(params, motor, sensor);
+
+   CookedAngle target(axisAngle(motor).val + scenario.distance);
+   float direction = (scenario.distance > 0 ? 1 : -1);
+
+   // The overshoot is followed through the angles the controller measures,
+   // as the simulator can not be accessed during the slew.
+   degrees overshoot = 0;
+   auto progress = [&](const StatusSnapshot& status)
+      {
+         overshoot = std::max<degrees>(overshoot,
+                                       direction * (status.cookedAngle - target.val));
+      };
+
+   auto start = std::chrono::steady_clock::now();
+   auto slew = controller.slewAsync(target, progress, nullptr,
+                                    std::chrono::milliseconds(10));
+   if (scenario.stopAfter.count())
+   {
+      std::this_thread::sleep_for(scenario.stopAfter);
+      slew->cancel(SlewHandle::Cancel::Graceful);
+   }
+
+   Result result;
+   result.outcome = (int)slew->wait();
+   std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+   result.time = elapsed.count();
+   result.iterations = controller.currentStatus().tick;
+
+   // Let the axis coast to a standstill.
+   std::this_thread::sleep_for(std::chrono::milliseconds(500));
+   degrees final = axisAngle(motor).val;
+   result.overshoot = std::max<degrees>(overshoot, direction * (final - target.val));
+   result.error = std::abs(final - target.val);
+   return result;
+}
+
+
+static std::map<std::string, Result> loadBaselines(const std::string& filename)
+{
+   std::map<std::string, Result> baselines;
+   std::ifstream file(filename);
+   std::string line;
+   while (std::getline(file, line))
+   {
+      if (line.empty() || line[0] == '#')
+         continue;
+      std::istringstream fields(line);
+      std::string name;
+      Result r;
+      if (fields >> name >> r.outcome >> r.time >> r.overshoot >> r.error
+                 >> r.iterations)
+         baselines[name] = r;
+   }
+   return baselines;
+}
+
+
+static bool saveBaselines(const std::string& filename,
+                          const std::map<std::string, Result>& results)
+{
+   std::ofstream file(filename);
+   file << "# mcontrol_scenarios baselines (update with --update)\n"
+        << "# name outcome time[s] overshoot[deg] error[deg] iterations\n";
+   for (const Scenario& scenario : scenarios)
+   {
+      const Result& r = results.at(scenario.name);
+      char line[128];
+      snprintf(line, sizeof(line), "%s %d %.2f %.3f %.3f %lu\n", scenario.name,
+               r.outcome, r.time, r.overshoot, r.error, r.iterations);
+      file << line;
+   }
+   return file.good();
+}
+
+
+static void printResult(const char* label, const Result& r)
+{
+   printf("  %-10s outcome %d, %6.2f s, overshoot %6.3f, error %6.3f, %5lu iterations\n",
+          label, r.outcome, r.time, r.overshoot, r.error, r.iterations);
+}
+
+
+int main(int argc, char* argv[])
+{
+   std::string configFile;
+   std::string baselineFile;
+   bool update;
+   std::vector<std::string> only;
+   try
+   {
+      TCLAP::CmdLine cmd("Control quality scenarios");
+      TCLAP::ValueArg<std::string> arg_config("c", "config",
+         "Configuration file", false, "mcontrol.conf", "FILE", cmd);
+      TCLAP::ValueArg<std::string> arg_baseline("b", "baseline",
+         "Baseline file", false, "scenarios.baseline", "FILE", cmd);
+      TCLAP::SwitchArg arg_update("u", "update",
+         "Write the results into the baseline file", cmd);
+      TCLAP::UnlabeledMultiArg<std::string> arg_only("scenario",
+         "Run only the given scenarios", false, "NAME", cmd);
+      cmd.parse(argc, argv);
+      configFile = arg_config.getValue();
+      baselineFile = arg_baseline.getValue();
+      update = arg_update.getValue();
+      only = arg_only.getValue();
+   }
+   catch (TCLAP::ArgException& e)
+   {
+      std::cerr << "error: " << e.error() << " for arg " << e.argId() << "\n";
+      return 1;
+   }
+
+   // The scenarios start from scratch (no motor model, no friction map) and
+   // leave no history.
+   ControllerParams params;
+   try
+   {
+      params = loadControllerParams(configFile.c_str());
+   }
+   catch (ConfigFileException& e)
+   {
+      std::cerr << "config file: " << e.message << "\n";
+      return 1;
+   }
+   params.model = MotorModel();
+   params.modelFile.clear();
+   params.friction = FrictionMap();
+   params.frictionFile.clear();
+   params.historyFile.clear();
+   params.indicatorStyle = ControllerParams::IndicatorStyle::None;
+
+   std::map<std::string, Result> baselines = loadBaselines(baselineFile);
+   std::map<std::string, Result> results;
+   int regressions = 0;
+   for (const Scenario& scenario : scenarios)
+   {
+      if (!only.empty() &&
+          std::find(only.begin(), only.end(), scenario.name) == only.end())
+         continue;
+
+      Result result = run(scenario, params);
+      results[scenario.name] = result;
+
+      // A scenario without a baseline can not pass (a missing or truncated
+      // baseline file must not look like success), except when the
+      // baselines are being written.
+      auto baseline = baselines.find(scenario.name);
+      const char* verdict = (update ? "new" : "NO BASELINE");
+      if (baseline != baselines.end())
+      {
+         bool ok = withinTolerance(result, baseline->second);
+         verdict = (ok ? "ok" : "REGRESSION");
+         regressions += !ok;
+      }
+      else if (!update)
+         regressions++;
+      printf("%-14s %s\n", scenario.name, verdict);
+      printResult("result", result);
+      if (baseline != baselines.end())
+         printResult("baseline", baseline->second);
+   }
+
+   if (update)
+   {
+      if (!only.empty())
+      {
+         std::cerr << "error: --update needs all of the scenarios\n";
+         return 1;
+      }
+      if (!saveBaselines(baselineFile, results))
+      {
+         perror(baselineFile.c_str());
+         return 1;
+      }
+      return 0;
+   }
+   return (regressions ? 1 : 0);
+}
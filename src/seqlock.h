@@ -0,0 +1,103 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/* A sequence lock: a value that one thread updates and any number of other
+ * threads read, without any locks. The writer is never held up by the
+ * readers; a reader that catches the writer in the middle of an update just
+ * tries again.
+ *
+ * The value is kept in atomic words (accessed with relaxed ordering), which
+ * makes the concurrent accesses well defined. It has to be trivially
+ * copyable. Since the atomics involved are lock-free, a SeqLock can also be
+ * placed in memory shared between processes.
+*/
+template <class T>
+class SeqLock
+{
+   static_assert(std::is_trivially_copyable<T>::value,
+                 "SeqLock values must be trivially copyable");
+
+public:
+   SeqLock() : sequence(0)
+   {
+      for (auto& word : words)
+         word.store(0, std::memory_order_relaxed);
+   }
+
+   // Publish a new value (single writer only).
+   void store(const T& value)
+   {
+      uint32_t buffer[numberOfWords] = {};
+      std::memcpy(buffer, &value, sizeof(T));
+
+      uint32_t seq = sequence.load(std::memory_order_relaxed);
+      sequence.store(seq + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      for (unsigned int i = 0; i < numberOfWords; i++)
+         words[i].store(buffer[i], std::memory_order_relaxed);
+      sequence.store(seq + 2, std::memory_order_release);
+   }
+
+   // Try to read a consistent value. Fails if the writer got in the way.
+   bool tryLoad(T& value) const
+   {
+      uint32_t buffer[numberOfWords];
+      uint32_t before = sequence.load(std::memory_order_acquire);
+      if (before & 1)
+         return false;
+      for (unsigned int i = 0; i < numberOfWords; i++)
+         buffer[i] = words[i].load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (sequence.load(std::memory_order_relaxed) != before)
+         return false;
+
+      std::memcpy(&value, buffer, sizeof(T));
+      return true;
+   }
+
+   // Read a consistent value (retrying as long as necessary).
+   T load() const
+   {
+      T value;
+      while (!tryLoad(value))
+         ;
+      return value;
+   }
+
+   // The number of completed updates, times two.
+   inline uint32_t version() const
+      { return sequence.load(std::memory_order_acquire) & ~1u; }
+
+private:
+   static const unsigned int numberOfWords = (sizeof(T) + 3) / 4;
+
+   std::atomic<uint32_t> sequence;
+   std::atomic<uint32_t> words[numberOfWords];
+};
+
+#endif // SEQLOCK_H
@@ -0,0 +1,218 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include "sharedstatus.h"
+
+const char* const sharedStatusName = "/mcontrol";
+const uint32_t SharedStatusSegment::expectedMagic;
+
+// How many times read() tries to get a consistent snapshot.
+static const unsigned int maximumReadAttempts = 100;
+
+
+static bool processAlive(pid_t pid)
+{
+   return pid != 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+
+bool SharedStatusWriter::open(const char* name)
+{
+   close();
+
+   // Only the process that creates the segment lays it out. Should there be
+   // a segment that is not laid out as expected (one left behind by an
+   // incompatible version or by a process that died while creating it), it
+   // is unlinked and created afresh; readers that still have it mapped are
+   // not disturbed.
+   bool created = false;
+   int fd = -1;
+   for (unsigned int attempt = 0; attempt < 3 && !segment; attempt++)
+   {
+      // Readable by everyone: mcontrol usually runs as root.
+      fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+      created = (fd != -1);
+      if (!created && errno == EEXIST)
+         fd = shm_open(name, O_RDWR, 0);
+      if (fd == -1)
+      {
+         if (errno == ENOENT)
+            continue;
+         return false;
+      }
+
+      struct stat info;
+      if (created ? ftruncate(fd, sizeof(SharedStatusSegment)) != 0 :
+                    fstat(fd, &info) != 0)
+      {
+         int error = errno;
+         ::close(fd);
+         errno = error;
+         return false;
+      }
+      if (!created && info.st_size != (off_t)sizeof(SharedStatusSegment))
+      {
+         ::close(fd);
+         shm_unlink(name);
+         continue;
+      }
+
+      void* memory = mmap(nullptr, sizeof(SharedStatusSegment),
+                          PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      int error = errno;
+      ::close(fd);
+      if (memory == MAP_FAILED)
+      {
+         errno = error;
+         return false;
+      }
+
+      segment = static_cast<SharedStatusSegment*>(memory);
+      if (created)
+      {
+         new (segment) SharedStatusSegment;
+         segment->size = sizeof(SharedStatusSegment);
+         segment->publisherPid = 0;
+         std::atomic_thread_fence(std::memory_order_release);
+         segment->magic = SharedStatusSegment::expectedMagic;
+      }
+      else if (segment->magic != SharedStatusSegment::expectedMagic ||
+               segment->size != sizeof(SharedStatusSegment))
+      {
+         munmap(segment, sizeof(SharedStatusSegment));
+         segment = nullptr;
+         shm_unlink(name);
+      }
+   }
+   if (!segment)
+   {
+      errno = EBUSY;
+      return false;
+   }
+
+   // Claim the segment. Of any number of processes that find it without a
+   // live publisher at the same time, only one gets it.
+   pid_t pid = segment->publisherPid;
+   bool claimed = (pid == getpid() || !processAlive(pid)) &&
+      segment->publisherPid.compare_exchange_strong(pid, getpid());
+   if (!claimed)
+   {
+      munmap(segment, sizeof(SharedStatusSegment));
+      segment = nullptr;
+      errno = EBUSY;
+      return false;
+   }
+
+   if (!created)
+   {
+      // Taking over from a publisher that is gone. It may have died in the
+      // middle of an update, leaving the seqlock odd for good, so start the
+      // snapshot afresh. The readers only see a snapshot without a tick
+      // until the first update.
+      new (&segment->status) SeqLock<StatusSnapshot>;
+      std::atomic_thread_fence(std::memory_order_release);
+   }
+   return true;
+}
+
+
+void SharedStatusWriter::close()
+{
+   if (!segment)
+      return;
+   segment->publisherPid = 0;
+   munmap(segment, sizeof(SharedStatusSegment));
+   segment = nullptr;
+}
+
+
+bool SharedStatusReader::open(const char* name)
+{
+   close();
+
+   int fd = shm_open(name, O_RDONLY, 0);
+   if (fd == -1)
+      return false;
+
+   struct stat info;
+   void* memory = MAP_FAILED;
+   if (fstat(fd, &info) == 0 && info.st_size >= (off_t)sizeof(SharedStatusSegment))
+      memory = mmap(nullptr, sizeof(SharedStatusSegment), PROT_READ,
+                    MAP_SHARED, fd, 0);
+   ::close(fd);
+   if (memory == MAP_FAILED)
+      return false;
+
+   segment = static_cast<const SharedStatusSegment*>(memory);
+   if (segment->magic != SharedStatusSegment::expectedMagic ||
+       segment->size != sizeof(SharedStatusSegment))
+   {
+      close();
+      return false;
+   }
+   return true;
+}
+
+
+void SharedStatusReader::close()
+{
+   if (!segment)
+      return;
+   munmap(const_cast<SharedStatusSegment*>(segment), sizeof(SharedStatusSegment));
+   segment = nullptr;
+}
+
+
+pid_t SharedStatusReader::publisher() const
+{
+   return segment ? segment->publisherPid.load() : 0;
+}
+
+
+bool SharedStatusReader::read(StatusSnapshot& status,
+                              std::chrono::nanoseconds maximumAge) const
+{
+   if (!segment || publisher() == 0)
+      return false;
+
+   // A publisher that keeps getting in the way (or one that died in the
+   // middle of an update) must not make the reader spin forever.
+   unsigned int attempts = 0;
+   while (!segment->status.tryLoad(status))
+   {
+      if (++attempts == maximumReadAttempts)
+         return false;
+      std::this_thread::yield();
+   }
+   if (status.tick == 0)
+      return false;
+
+   auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+   return now - status.timestamp <= maximumAge.count();
+}
@@ -0,0 +1,112 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SHAREDSTATUS_H
+#define SHAREDSTATUS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <sys/types.h>
+#include "seqlock.h"
+#include "status.h"
+
+/* Publication of the controller status in POSIX shared memory.
+ *
+ * While a slew is running, the controller keeps its latest status snapshot
+ * in a shared memory segment, where any number of other processes can read
+ * it without system calls, locks or any influence on the control loop (the
+ * snapshot is protected by a seqlock). When the controller exits, it clears
+ * the publisher PID; should it die without doing so, its last snapshot just
+ * grows old. Readers tell a live snapshot from a stale one by the PID and the
+ * timestamp alone, as asking the kernel about the publisher would take a
+ * system call (and tell nothing across PID namespaces anyway).
+ *
+ * The reader is also built into a small static library (mcontrol_status)
+ * for programs that want to follow the axis position.
+*/
+
+// The default name of the shared memory segment.
+extern const char* const sharedStatusName;
+
+struct SharedStatusSegment
+{
+   // Identification of the segment layout.
+   uint32_t magic;
+   uint32_t size;
+
+   // The process that publishes the status (zero if none).
+   std::atomic<int32_t> publisherPid;
+
+   SeqLock<StatusSnapshot> status;
+
+   static const uint32_t expectedMagic = 0x6d637331;
+};
+
+
+class SharedStatusWriter
+{
+public:
+   SharedStatusWriter() = default;
+   ~SharedStatusWriter() { close(); }
+
+   // Create (or take over) the segment. Fails with EBUSY if another live
+   // process is publishing there or claims it at the same time. Returns
+   // false on failure, with errno set.
+   bool open(const char* name = sharedStatusName);
+   void close();
+
+   inline void publish(const StatusSnapshot& status)
+      { segment->status.store(status); }
+
+   inline SeqLock<StatusSnapshot>& channel() { return segment->status; }
+
+private:
+   SharedStatusSegment* segment = nullptr;
+};
+
+
+class SharedStatusReader
+{
+public:
+   SharedStatusReader() = default;
+   ~SharedStatusReader() { close(); }
+
+   // Map the segment. Returns false if there is no (valid) segment.
+   bool open(const char* name = sharedStatusName);
+   void close();
+
+   // Get the latest snapshot. Returns false if there is no publisher, if no
+   // consistent snapshot could be read (after a bounded number of attempts)
+   // or if the snapshot is older than maximumAge (which is what reveals a
+   // publisher that died without clearing its PID). Makes no system calls.
+   bool read(StatusSnapshot& status,
+             std::chrono::nanoseconds maximumAge = std::chrono::seconds(1)) const;
+
+   // The PID of the publishing process (zero if none). This is what the
+   // publisher left there; callers that need to know whether the process is
+   // still alive can check that themselves.
+   pid_t publisher() const;
+
+private:
+   const SharedStatusSegment* segment = nullptr;
+};
+
+#endif // SHAREDSTATUS_H
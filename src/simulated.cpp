@@ -18,41 +18,47 @@
  *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <cmath>
 #include <iostream>
-#include <ratio>
 #include "simulated.h"
 #include "angles.h"
 
 SimulatedMotor::SimulatedMotor(degrees relativeInitialAngle)
 {
   internalAngle = initialAngle + relativeInitialAngle;
+  lastEvent = std::chrono::steady_clock::now();
 }
 
 void SimulatedMotor::turnOnDir1()
 {
-   event();
-   engaged = 1;
+   setRelays(true, false);
    if (verbose)
      std::cerr << "motor: Dir1\n";
 }
 
 void SimulatedMotor::turnOnDir2()
 {
-   event();
-   engaged = -1;
+   setRelays(false, true);
    if (verbose)
       std::cerr << "motor: Dir2\n";
 }
 
 void SimulatedMotor::turnOff()
 {
-   event();
-   engaged = 0;
-   destallTries = 0;
+   setRelays(false, false);
    if (verbose)
       std::cerr << "motor: off\n";
 }
 
+void SimulatedMotor::setRelays(bool relay1, bool relay2)
+{
+   event();
+   switchRelay(relays[0], relay1);
+   switchRelay(relays[1], relay2);
+   if (!relay1 && !relay2)
+      destallTries = 0;
+}
+
 /* This class monitors a condition and prints a message when the condition
  * changes from true to false. Useful for pointing out the exact moment at
  * which an assertion is first violated, but keeping silent at all other times.
@@ -67,7 +73,7 @@ public:
       return result;
    }
 
-   void operator()(const bool state, const std::string& message)
+   void operator()(const bool state, const char* message)
    {
       if (operator()(state))
          std::cout << message;
@@ -77,7 +83,12 @@ private:
    bool oldState = false;
 };
 
-void SimulatedMotor::setPWM(unsigned short duty)
+void SimulatedMotor::configurePWM(unsigned int range, unsigned int frequency)
+{
+   pwmRange = range;
+}
+
+void SimulatedMotor::setPWM(float duty)
 {
    {
       // Warn the user if the duty cycle exceeds the safe limit.
@@ -89,6 +100,7 @@ void SimulatedMotor::setPWM(unsigned short duty)
 
    if (duty > maximum_duty)
       duty = maximum_duty;
+   duty = std::round(duty * pwmRange / 100) * 100 / pwmRange;
 
    event();
    this->duty = duty;
@@ -109,27 +121,92 @@ bool SimulatedMotor::initialStall()
 }
 
 
+void SimulatedMotor::switchRelay(Relay& relay, bool on)
+{
+   if (relay.on != on)
+   {
+      relay.on = on;
+      relay.switchedAt = lastEvent;
+   }
+}
+
+bool SimulatedMotor::contactsClosed(const Relay& relay,
+                                    std::chrono::steady_clock::time_point time)
+{
+   if (relay.on)
+      return time - relay.switchedAt >= relay_operate_time;
+   return time - relay.switchedAt < relay_release_time;
+}
+
+int SimulatedMotor::engagement(std::chrono::steady_clock::time_point time)
+{
+   bool closed1 = contactsClosed(relays[0], time);
+   bool closed2 = contactsClosed(relays[1], time);
+
+   // Report the supply being shorted through both relays.
+   static assertTrigger t;
+   t(closed1 && closed2, "motor: ERROR: both relays closed!\n");
+
+   if (closed1 == closed2)
+      return 0;
+   return (closed1 ? 1 : -1);
+}
+
+int SimulatedMotor::contactDirection()
+{
+   event();
+   return engagement(lastEvent);
+}
+
 void SimulatedMotor::event()
 {
    // Check if we are in an initial stall. If yes, a certain PWM duty cycle
    // threshold (stall_overcome_duty) needs to be exceeded a certain number of
    // times (initialStalls) to unblock the motor.
-   if (engaged && initialStall() && (duty >= stall_overcome_duty))
+   if (engagement(lastEvent) && initialStall() && (duty >= stall_overcome_duty))
       destallTries++;
 
-   if (engaged && !initialStall())
+   // The relay contacts move some time after they are switched. Advance to
+   // every such moment in turn, so that the motor is driven only while the
+   // contacts are closed.
+   auto currentTime = std::chrono::steady_clock::now();
+   while (true)
    {
-      // Normal operation. Update the position according to the direction of
-      // spinning and the time elapsed since the previous event.
+      auto next = std::chrono::steady_clock::time_point::max();
+      for (const Relay& relay : relays)
+      {
+         auto moved = relay.switchedAt +
+            (relay.on ? relay_operate_time : relay_release_time);
+         if (moved > lastEvent && moved < next)
+            next = moved;
+      }
+      if (next > currentTime)
+         break;
+
+      advance(next);
+      if (duty > 0)
+         std::cerr << "motor: WARNING: relay switched under load!\n";
+   }
+   advance(currentTime);
+}
+
+void SimulatedMotor::advance(std::chrono::steady_clock::time_point time)
+{
+   int engaged = engagement(lastEvent);
+   if (!(engaged && initialStall()))
+   {
+      // Normal operation (or coasting to a stop when the motor is off).
+      // Update the position and the velocity according to the direction of
+      // spinning and the time elapsed since the previous event: the
+      // velocity approaches the steady one exponentially.
       using std::chrono::duration_cast;
       using std::chrono::duration;
-      using std::ratio;
 
-      float effectiveDuty = (duty < minimum_duty ? 0 : duty) / 100.0;
-      float rpm = rpm_capability * effectiveDuty;
-      auto currentTime = std::chrono::steady_clock::now();
-      auto elapsedMin = duration_cast<duration<float,ratio<60,1>>>(currentTime - lastEvent).count();
-      internalAngle += 360.0 * (rpm * elapsedMin * engaged);
+      float target = engaged * steadyVelocity();
+      float elapsed = duration_cast<duration<float>>(time - lastEvent).count();
+      float decay = std::exp(-elapsed / time_constant);
+      internalAngle += target * elapsed + (velocity - target) * time_constant * (1 - decay);
+      velocity = target + (velocity - target) * decay;
 
       {
          // Warn if the motor reached the lower end switch.
@@ -142,7 +219,10 @@ void SimulatedMotor::event()
       }
       // Do not allow rotating past the end switch.
       if (internalAngle < minimum_angle)
+      {
          internalAngle = minimum_angle;
+         velocity = 0;
+      }
 
       {
          // Warn if the motor reached the upper end switch.
@@ -155,12 +235,32 @@ void SimulatedMotor::event()
       }
       // Do not allow rotating past the end switch.
       if (internalAngle > maximum_angle)
+      {
          internalAngle = maximum_angle;
+         velocity = 0;
+      }
    }
+   else
+      velocity = 0;
 
-   lastEvent = std::chrono::steady_clock::now();
+   lastEvent = time;
 }
 
+float SimulatedMotor::steadyVelocity()
+{
+   // From standstill, the motor needs at least minimum_duty to get going.
+   degrees offset = std::abs(mod360(internalAngle - stiff_angle + 180) - 180);
+   float stiffness = std::max<float>(0, stiff_duty * (1 - offset / stiff_width));
+   bool moving = std::abs(velocity) > 0.01;
+   if (duty < (moving ? kinetic_duty : minimum_duty) + stiffness)
+      return 0;
+
+   float maxVelocity = rpm_capability * 360.0 / 60.0;
+   float load = kinetic_duty + stiffness;
+   return maxVelocity * std::pow((duty - load) / (100 - load), velocity_exponent);
+}
+
+
 degrees SimulatedMotor::currentAngle()
 {
    event();
@@ -172,8 +272,17 @@ void SimulatedMotor::setVerbose(const bool verbose_)
    verbose = verbose_;
 }
 
+void SimulatedMotor::setInitialStalls(int stalls)
+{
+   initialStalls = stalls;
+   destallTries = 0;
+}
+
 
-SimulatedSensor::SimulatedSensor(SimulatedMotor* driver) : motor(driver)
+SimulatedSensor::SimulatedSensor(SimulatedMotor* driver, degrees noise,
+                                 unsigned int spikePeriod, uint64_t seed) :
+   motor(driver), generator(seed), normdist(0.0, noise),
+   randomSpikePeriod(spikePeriod)
 {}
 
 RawAngle SimulatedSensor::getRawAngle()
@@ -187,3 +296,8 @@ RawAngle SimulatedSensor::getRawAngle()
 
    return RawAngle(mod360(motor->currentAngle() + normdist(generator)));
 }
+
+RawCode SimulatedSensor::getRawCode()
+{
+   return RawCode::fromDegrees(getRawAngle().val);
+}
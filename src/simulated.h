@@ -29,22 +29,50 @@
  *
  * This emulates a motor spinning an axis and exhibiting real-world
  * characteristics such as initial stall and range limited by end switches.
+ * The speed is a nonlinear function of the duty cycle with a dead zone
+ * (which is wider when starting from standstill than when already moving,
+ * and wider still in a stiff part of the range) and follows changes of the
+ * duty with a first-order lag. The relays of the H-bridge take some time to
+ * switch.
  * All error conditions are logged to stderr.
 */
-class SimulatedMotor : public Motor
+class SimulatedMotor final : public Motor
 {
 public:
    SimulatedMotor(degrees relativeInitialAngle = 0);
    void turnOff();
-   void setPWM(unsigned short duty);
+   void setPWM(float duty);
    degrees currentAngle();
 
+   // The duty cycle is quantized to range steps, as on the real hardware.
+   // The frequency is not simulated.
+   void configurePWM(unsigned int range, unsigned int frequency);
+
    // In verbose mode, the simulator reports various information (starts,
    // stops, duty cycle changes etc.) to stderr. If set to false, the simulator
    // will only report error conditions, such as the axis hitting an end switch.
    void setVerbose(bool verbose);
 
+   // Make the motor start from an initial stall, which takes the given
+   // number of events with at least stall_overcome_duty to overcome.
+   void setInitialStalls(int stalls);
+
+   // The direction in which the motor is actually connected: the relay
+   // contacts follow the commands only after relay_operate_time (closing)
+   // or relay_release_time (opening). 0 while both are open.
+   int contactDirection();
+
+   // Switch the relays individually, as their control pins do (the motor
+   // commands switch them in pairs).
+   void setRelays(bool relay1, bool relay2);
+
 private:
+   struct Relay
+   {
+      bool on = false;
+      std::chrono::steady_clock::time_point switchedAt;
+   };
+
    void turnOnDir1();
    void turnOnDir2();
 
@@ -54,18 +82,36 @@ private:
    // previous event.
    void event();
 
+   // Update the motor state up to the given time, with the relay contacts
+   // as they were at the previous event.
+   void advance(std::chrono::steady_clock::time_point time);
+
+   // Relay helpers: command a relay, and check its contacts (or the
+   // resulting direction) at the given time.
+   void switchRelay(Relay& relay, bool on);
+   bool contactsClosed(const Relay& relay,
+                       std::chrono::steady_clock::time_point time);
+   int engagement(std::chrono::steady_clock::time_point time);
+
    // A helper method to check if we are in an initial stall.
    bool initialStall();
 
-   // engaged: 0 when still, 1 or -1 when energized (depending on direction)
-   int engaged = 0;
-   // PWM duty cycle
-   int duty = 0;
+   // The velocity (in degrees per second) at which the axis settles with
+   // the current duty cycle.
+   float steadyVelocity();
+
+   // The relays for the two directions.
+   Relay relays[2];
+   // PWM duty cycle, and the number of PWM steps
+   float duty = 0;
+   unsigned int pwmRange = 100;
    // How many destall maneuvers need to be performed to finally move the motor.
    int initialStalls = 0;
    // How many destall maneuvers we already noticed.
    int destallTries = 0;
    degrees internalAngle;
+   // Current velocity in degrees per second (signed).
+   float velocity = 0;
    std::chrono::steady_clock::time_point lastEvent;
    bool verbose = false;
 
@@ -76,10 +122,31 @@ private:
    const degrees maximum_angle = minimum_angle + 360 - 40;
    const float rpm_capability = 10.0 / 6.0;
 
+   // Once moving, the motor keeps turning down to kinetic_duty. Above that,
+   // the speed goes as ((duty - kinetic_duty) / (100 - kinetic_duty))^
+   // velocity_exponent of the full speed, and approaches it with the time
+   // constant (in seconds).
+   const float kinetic_duty = 12;
+   const float velocity_exponent = 0.8;
+   const float time_constant = 0.2;
+
+   // Around stiff_angle (within stiff_width), the friction is higher: both
+   // dead zones rise by up to stiff_duty.
+   const degrees stiff_angle = 285;
+   const degrees stiff_width = 15;
+   const float stiff_duty = 4;
+
    // If initial stall simulation is enabled, a PWM cycle of at least
    // stall_overcome_duty will be needed for the motor to start moving.
    // Once the motor overcomes the stall, the duty cycle can be lowered.
    const unsigned short stall_overcome_duty = 20;
+
+   // The relays close relay_operate_time after they are switched on (the
+   // contact bounce included) and open relay_release_time after they are
+   // switched off. Switching with the PWM on, or closing one relay before
+   // the other one has opened, is reported.
+   const std::chrono::milliseconds relay_operate_time{10};
+   const std::chrono::milliseconds relay_release_time{5};
 };
 
 
@@ -87,19 +154,26 @@ private:
  * noisy signal: a normally distributed random value is added to the real
  * angle value and a completely random spike is inserted every now and then.
 */
-class SimulatedSensor : public Sensor
+class SimulatedSensor final : public Sensor
 {
 public:
-   SimulatedSensor(SimulatedMotor* driver);
+   // noise: standard deviation of the readouts
+   // spikePeriod: a random value is returned every spikePeriod readouts;
+   //              zero disables the spikes
+   // seed: of the random number generator
+   SimulatedSensor(SimulatedMotor* driver, degrees noise = 0.1,
+                   unsigned int spikePeriod = 233,
+                   uint64_t seed = std::mt19937_64::default_seed);
    RawAngle getRawAngle();
+   RawCode getRawCode();
 
 private:
    SimulatedMotor* motor;
    std::mt19937_64 generator;
-   std::normal_distribution<degrees> normdist{0.0, 0.1};
+   std::normal_distribution<degrees> normdist;
    unsigned int numberOfReadouts = 0;
 
-   const unsigned int randomSpikePeriod = 233;
+   const unsigned int randomSpikePeriod;
    std::uniform_real_distribution<degrees> spikedist{0.0, 360.0};
 };
 
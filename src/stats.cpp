@@ -0,0 +1,182 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <csignal>
+#include "output.h"
+#include "stats.h"
+
+unsigned int LatencyHistogram::bucketIndex(uint64_t value)
+{
+   // Values below 16 get a bucket each. Above that, the row is given by the
+   // position of the leading bit and the sub-bucket by the next four bits.
+   if (value < subBuckets)
+      return value;
+
+   unsigned int magnitude = 63 - __builtin_clzll(value);
+   unsigned int row = magnitude - subBucketBits + 1;
+   if (row >= rows)
+      return numberOfBuckets - 1;
+   unsigned int sub = (value >> (magnitude - subBucketBits)) & (subBuckets - 1);
+   return row * subBuckets + sub;
+}
+
+
+uint64_t LatencyHistogram::bucketValue(unsigned int index)
+{
+   // The middle of the range of values that map to the bucket.
+   unsigned int row = index / subBuckets;
+   unsigned int sub = index % subBuckets;
+   if (row == 0)
+      return sub;
+
+   unsigned int shift = row - 1;
+   uint64_t low = (uint64_t)(subBuckets + sub) << shift;
+   return low + ((uint64_t)1 << shift) / 2;
+}
+
+
+void LatencyHistogram::record(std::chrono::nanoseconds duration)
+{
+   uint64_t value = (duration.count() > 0 ? duration.count() : 0);
+   buckets[bucketIndex(value)]++;
+   total++;
+   sum += value;
+   if (value > max)
+      max = value;
+}
+
+
+void LatencyHistogram::reset()
+{
+   for (auto& bucket : buckets)
+      bucket = 0;
+   total = 0;
+   sum = 0;
+   max = 0;
+}
+
+
+std::chrono::nanoseconds LatencyHistogram::percentile(double fraction) const
+{
+   if (total == 0)
+      return std::chrono::nanoseconds(0);
+
+   uint64_t wanted = (uint64_t)(fraction * total + 0.5);
+   if (wanted < 1)
+      wanted = 1;
+
+   uint64_t seen = 0;
+   for (unsigned int i = 0; i < numberOfBuckets; i++)
+   {
+      seen += buckets[i];
+      if (seen >= wanted)
+      {
+         // No need to report a value above the actual maximum.
+         uint64_t value = bucketValue(i);
+         return std::chrono::nanoseconds(value < max ? value : max);
+      }
+   }
+   return maximum();
+}
+
+
+void SlewStatistics::reset()
+{
+   sensorReadout.reset();
+   cookedAngle.reset();
+   dutyComputation.reset();
+   setPWM.reset();
+   progress.reset();
+   loopDelay.reset();
+   tickLateness.reset();
+   missedTicks = 0;
+}
+
+
+/* Formats the report one line at a time and hands every line to the sink. */
+template <typename Sink>
+void SlewStatistics::report(Sink sink) const
+{
+   struct { const char* name; const LatencyHistogram* histogram; } stages[] = {
+      { "sensor readout", &sensorReadout },
+      { "getCookedAngle", &cookedAngle },
+      { "duty computation", &dutyComputation },
+      { "setPWM", &setPWM },
+      { "progress output", &progress },
+      { "loop delay", &loopDelay },
+      { "tick lateness", &tickLateness }
+   };
+
+   auto us = [](std::chrono::nanoseconds ns) { return ns.count() / 1000.0; };
+
+   char line[128];
+   snprintf(line, sizeof(line), "\n%-20s %10s %12s %12s %12s\n",
+            "stage", "count", "p50 [us]", "p99 [us]", "max [us]");
+   sink(line);
+   for (auto& stage : stages)
+   {
+      const LatencyHistogram& h = *stage.histogram;
+      snprintf(line, sizeof(line), "%-20s %10llu %12.1f %12.1f %12.1f\n",
+               stage.name, (unsigned long long)h.count(),
+               us(h.percentile(0.5)), us(h.percentile(0.99)), us(h.maximum()));
+      sink(line);
+   }
+   snprintf(line, sizeof(line), "(missed ticks: %llu)\n",
+            (unsigned long long)missedTicks);
+   sink(line);
+   snprintf(line, sizeof(line), "(sensor noise: %.4f deg, spike rate: %.2f %%)\n",
+            sensorNoise, 100 * spikeRate);
+   sink(line);
+}
+
+
+void SlewStatistics::print(FILE* stream) const
+{
+   report([stream](const char* line) { fputs(line, stream); });
+}
+
+
+void SlewStatistics::post(AsyncOutput& output, FILE* stream) const
+{
+   report([&output, stream](const char* line) { output.message(stream, "%s", line); });
+}
+
+
+static std::atomic_bool reportRequested(false);
+
+static void usr1_handler(int sig)
+{
+   reportRequested = true;
+}
+
+void reportStatisticsOnSignal()
+{
+   struct sigaction action = {};
+   action.sa_handler = usr1_handler;
+   sigemptyset(&action.sa_mask);
+   action.sa_flags = SA_RESTART;
+   sigaction(SIGUSR1, &action, nullptr);
+}
+
+bool statisticsReportRequested()
+{
+   return reportRequested.exchange(false);
+}
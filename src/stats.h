@@ -0,0 +1,142 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+class AsyncOutput;
+
+/* A histogram of latencies with logarithmic buckets, in the spirit of
+ * HdrHistogram: values are grouped by their power of two and every power of
+ * two is further split into 16 linear sub-buckets. This gives a relative
+ * precision of 1/16 over the whole range from 1 ns to several hours with a
+ * fixed amount of memory and a constant recording cost.
+*/
+class LatencyHistogram
+{
+public:
+   LatencyHistogram() { reset(); }
+
+   void record(std::chrono::nanoseconds duration);
+   void reset();
+
+   inline uint64_t count() const { return total; }
+   inline std::chrono::nanoseconds maximum() const
+      { return std::chrono::nanoseconds(max); }
+   inline double mean() const { return (total ? (double)sum / total : 0); }
+
+   // The value below which the given fraction (0 to 1) of the samples lay,
+   // to within the precision of the buckets.
+   std::chrono::nanoseconds percentile(double fraction) const;
+
+   // Bucket layout; public for the sake of anyone who wants to merge or
+   // serialize histograms.
+   static const unsigned int subBucketBits = 4;
+   static const unsigned int subBuckets = 1 << subBucketBits;
+   static const unsigned int rows = 41;
+   static const unsigned int numberOfBuckets = rows * subBuckets;
+
+   static unsigned int bucketIndex(uint64_t value);
+   static uint64_t bucketValue(unsigned int index);
+
+   uint64_t buckets[numberOfBuckets];
+
+private:
+   uint64_t total;
+   uint64_t sum;
+   uint64_t max;
+};
+
+
+/* Latencies of the individual stages of the control loop. */
+struct SlewStatistics
+{
+   LatencyHistogram sensorReadout;
+   LatencyHistogram cookedAngle;
+   LatencyHistogram dutyComputation;
+   LatencyHistogram setPWM;
+   LatencyHistogram progress;
+   LatencyHistogram loopDelay;
+
+   // How late the ticks of the loop were handled (against the period in
+   // effect for each of them), and how many were missed altogether.
+   LatencyHistogram tickLateness;
+   uint64_t missedTicks = 0;
+
+   // The sensor noise estimates at the end of the latest slew.
+   float sensorNoise = 0;
+   double spikeRate = 0;
+
+   void reset();
+
+   // Print out counts, medians, 99th percentiles and maxima of all stages.
+   void print(FILE* stream) const;
+
+   // The same report, posted line by line to the asynchronous output; this
+   // is what the control loop uses, as it must not block on the stream.
+   void post(AsyncOutput& output, FILE* stream) const;
+
+private:
+   template <typename Sink> void report(Sink sink) const;
+};
+
+
+/* Records the time elapsed from its creation until stop() is called (or
+ * until it goes out of scope) into one of the histograms of a SlewStatistics.
+ * With a null statistics pointer, it does not even read the clock.
+*/
+class StageTimer
+{
+public:
+   StageTimer(SlewStatistics* statistics, LatencyHistogram SlewStatistics::*stage) :
+      histogram(statistics ? &(statistics->*stage) : nullptr)
+   {
+      if (histogram)
+         start = std::chrono::steady_clock::now();
+   }
+
+   ~StageTimer() { stop(); }
+
+   void stop()
+   {
+      if (histogram)
+      {
+         histogram->record(std::chrono::steady_clock::now() - start);
+         histogram = nullptr;
+      }
+   }
+
+private:
+   LatencyHistogram* histogram;
+   std::chrono::steady_clock::time_point start;
+};
+
+
+// Make SIGUSR1 request a statistics report (for long-running processes).
+void reportStatisticsOnSignal();
+
+// Returns true if a report was requested since the previous call.
+bool statisticsReportRequested();
+
+#endif // STATS_H
@@ -0,0 +1,363 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "eventloop.h"
+#include "status.h"
+
+constexpr float StatusPublisher::defaultRate;
+
+
+static const char* phaseName(SlewPhase phase)
+{
+   switch (phase)
+   {
+      case SlewPhase::idle: return "idle";
+      case SlewPhase::accelerating: return "accelerating";
+      case SlewPhase::plateau: return "plateau";
+      case SlewPhase::decelerating: return "decelerating";
+   }
+   return "unknown";
+}
+
+
+static const char* motorStatusName(MotorStatus status)
+{
+   switch (status)
+   {
+      case MotorStatus::Undetermined: return "undetermined";
+      case MotorStatus::OK: return "ok";
+      case MotorStatus::Stalled: return "stalled";
+      case MotorStatus::WrongDirection: return "wrong direction";
+   }
+   return "unknown";
+}
+
+
+static const char* faultName(Fault fault)
+{
+   switch (fault)
+   {
+      case Fault::None: return "none";
+      case Fault::Stall: return "stall";
+      case Fault::WrongDirection: return "wrong direction";
+      case Fault::Interrupted: return "interrupted";
+      case Fault::EmergencyStop: return "emergency stop";
+      case Fault::SafetyTrip: return "safety trip";
+   }
+   return "unknown";
+}
+
+
+int formatStatus(const StatusSnapshot& status, char* buffer, std::size_t size)
+{
+   return snprintf(buffer, size,
+      "{\"tick\":%llu,\"time\":%lld.%06lld,\"user\":%.3f,\"cooked\":%.3f,"
+      "\"raw\":%.3f,\"velocity\":%.3f,\"duty\":%.2f,\"phase\":\"%s\","
+      "\"motor\":\"%s\",\"fault\":\"%s\"}\n",
+      (unsigned long long)status.tick,
+      (long long)(status.timestamp / 1000000000),
+      (long long)(status.timestamp % 1000000000 / 1000),
+      status.userAngle, status.cookedAngle, status.rawAngle,
+      status.velocity, status.duty, phaseName(status.phase),
+      motorStatusName(status.motorStatus), faultName(status.fault));
+}
+
+
+StatusPublisher::~StatusPublisher()
+{
+   stop();
+   for (auto& subscriber : subscribers)
+      if (subscriber.fd != STDOUT_FILENO)
+         close(subscriber.fd);
+   if (listenFd != -1)
+   {
+      close(listenFd);
+      unlink(socketPath.c_str());
+   }
+}
+
+
+std::chrono::nanoseconds StatusPublisher::periodOf(float rate)
+{
+   if (rate <= 0)
+      return std::chrono::nanoseconds(0);
+   return std::chrono::nanoseconds((int64_t)(1e9 / rate));
+}
+
+
+void StatusPublisher::subscribeStdout(float rate)
+{
+   subscribers.push_back(Subscriber{STDOUT_FILENO, periodOf(rate),
+                                    std::chrono::steady_clock::now(), 0, "", ""});
+}
+
+
+bool StatusPublisher::listen(const std::string& path)
+{
+   sockaddr_un address;
+   if (path.size() >= sizeof(address.sun_path))
+   {
+      errno = ENAMETOOLONG;
+      return false;
+   }
+   memset(&address, 0, sizeof(address));
+   address.sun_family = AF_UNIX;
+   strcpy(address.sun_path, path.c_str());
+
+   listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+   if (listenFd == -1)
+      return false;
+
+   // Remove a stale socket left over by a previous run.
+   unlink(path.c_str());
+   if (bind(listenFd, (sockaddr*)&address, sizeof(address)) == -1 ||
+       ::listen(listenFd, 8) == -1)
+   {
+      int error = errno;
+      close(listenFd);
+      listenFd = -1;
+      errno = error;
+      return false;
+   }
+   socketPath = path;
+   return true;
+}
+
+
+void StatusPublisher::start()
+{
+   if (thread.joinable())
+      return;
+   stopRequested = false;
+   thread = std::thread(&StatusPublisher::run, this);
+}
+
+
+void StatusPublisher::stop()
+{
+   if (!thread.joinable())
+      return;
+   stopRequested = true;
+   thread.join();
+
+   // The final state is what the subscribers are most interested in.
+   StatusSnapshot status = channel->load();
+   if (status.tick != 0)
+      for (auto& subscriber : subscribers)
+         deliver(subscriber, status, true);
+}
+
+
+void StatusPublisher::run()
+{
+   blockSignalsInThread();
+
+   std::vector<pollfd> fds;
+   while (!stopRequested)
+   {
+      // Wait for socket activity or until the next subscriber is due. With a
+      // subscriber that wants every tick, the new snapshots have to be
+      // looked for often.
+      auto now = std::chrono::steady_clock::now();
+      auto wait = std::chrono::nanoseconds(std::chrono::milliseconds(100));
+      for (auto& subscriber : subscribers)
+      {
+         if (subscriber.period.count() == 0)
+            wait = std::chrono::milliseconds(1);
+         else
+            wait = std::min(wait, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     subscriber.nextDue - now));
+      }
+      int timeout = std::max(1, (int)std::chrono::duration_cast<
+                                   std::chrono::milliseconds>(wait).count());
+
+      fds.clear();
+      if (listenFd != -1)
+         fds.push_back(pollfd{listenFd, POLLIN, 0});
+      for (auto& subscriber : subscribers)
+         if (subscriber.fd != STDOUT_FILENO)
+            fds.push_back(pollfd{subscriber.fd, POLLIN, 0});
+
+      int ready = poll(fds.data(), fds.size(), timeout);
+      if (ready > 0)
+      {
+         unsigned int next = 0;
+         if (listenFd != -1 && (fds[next++].revents & POLLIN))
+            acceptClient();
+
+         // Handle the commands of the clients and drop the ones that left.
+         for (auto i = subscribers.begin(); i != subscribers.end(); )
+         {
+            if (i->fd == STDOUT_FILENO)
+            {
+               ++i;
+               continue;
+            }
+            bool gone = false;
+            for (unsigned int j = next; j < fds.size(); j++)
+               if (fds[j].fd == i->fd && fds[j].revents)
+                  gone = !readCommands(*i);
+            if (gone)
+            {
+               close(i->fd);
+               i = subscribers.erase(i);
+            }
+            else
+               ++i;
+         }
+      }
+
+      StatusSnapshot status;
+      if (!channel->tryLoad(status) || status.tick == 0)
+         continue;
+      for (auto i = subscribers.begin(); i != subscribers.end(); )
+      {
+         if (deliver(*i, status, false))
+            ++i;
+         else
+         {
+            close(i->fd);
+            i = subscribers.erase(i);
+         }
+      }
+   }
+}
+
+
+void StatusPublisher::acceptClient()
+{
+   int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+   if (fd == -1)
+      return;
+   subscribers.push_back(Subscriber{fd, periodOf(defaultRate),
+                                    std::chrono::steady_clock::now(), 0, "", ""});
+}
+
+
+/* Reads and executes the commands sent by a client. Returns false if the
+ * client has disconnected.
+*/
+bool StatusPublisher::readCommands(Subscriber& subscriber)
+{
+   char buffer[256];
+   ssize_t length = recv(subscriber.fd, buffer, sizeof(buffer), 0);
+   if (length == 0 || (length == -1 && errno != EAGAIN && errno != EINTR))
+      return false;
+   if (length == -1)
+      return true;
+
+   subscriber.input.append(buffer, length);
+   std::string::size_type end;
+   while ((end = subscriber.input.find('\n')) != std::string::npos)
+   {
+      std::string line = subscriber.input.substr(0, end);
+      subscriber.input.erase(0, end + 1);
+
+      const char* value = nullptr;
+      if (line.compare(0, 5, "rate ") == 0)
+         value = line.c_str() + 5;
+      if (!value)
+         continue;
+
+      if (strncmp(value, "max", 3) == 0)
+         subscriber.period = std::chrono::nanoseconds(0);
+      else
+      {
+         char* parsed;
+         float rate = strtof(value, &parsed);
+         if (parsed != value && rate >= 0)
+            subscriber.period = periodOf(rate);
+      }
+      subscriber.nextDue = std::chrono::steady_clock::now();
+   }
+
+   // Do not let a misbehaving client fill up our memory.
+   if (subscriber.input.size() > 1024)
+      subscriber.input.clear();
+   return true;
+}
+
+
+/* Sends the status to a subscriber (if it is due). Returns false if the
+ * client has disconnected.
+*/
+bool StatusPublisher::deliver(Subscriber& subscriber,
+                              const StatusSnapshot& status, bool force)
+{
+   // A line that only partly fit into the socket goes out in full before
+   // anything else, so that the client never gets a broken line. Until
+   // then, the client misses the snapshots.
+   if (!subscriber.output.empty())
+   {
+      ssize_t n = send(subscriber.fd, subscriber.output.data(),
+                       subscriber.output.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+         return false;
+      if (n > 0)
+         subscriber.output.erase(0, n);
+      if (!subscriber.output.empty())
+         return true;
+   }
+
+   if (status.tick == subscriber.lastTick)
+      return true;
+
+   auto now = std::chrono::steady_clock::now();
+   if (!force && now < subscriber.nextDue)
+      return true;
+
+   char line[512];
+   int length = formatStatus(status, line, sizeof(line));
+   if (subscriber.fd == STDOUT_FILENO)
+   {
+      // The standard output is ours alone while publishing, so blocking on it
+      // only holds up this thread.
+      fflush(stdout);
+      for (int written = 0; written < length; )
+      {
+         ssize_t n = write(STDOUT_FILENO, line + written, length - written);
+         if (n <= 0 && errno != EINTR)
+            break;
+         if (n > 0)
+            written += n;
+      }
+   }
+   else
+   {
+      // A client that does not read fast enough misses this one.
+      ssize_t n = send(subscriber.fd, line, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+         return false;
+      if (n > 0 && n < length)
+         subscriber.output.assign(line + n, length - n);
+   }
+
+   subscriber.lastTick = status.tick;
+   subscriber.nextDue = std::max(subscriber.nextDue + subscriber.period, now);
+   return true;
+}
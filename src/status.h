@@ -0,0 +1,147 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STATUS_H
+#define STATUS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include "angles.h"
+#include "seqlock.h"
+
+enum class SlewPhase : uint8_t
+{
+   idle,
+   accelerating,
+   plateau,
+   decelerating
+};
+
+enum class MotorStatus : uint8_t { Undetermined, OK, Stalled, WrongDirection };
+
+// Reasons for a slew to end prematurely.
+enum class Fault : uint8_t
+{
+   None,
+   Stall,
+   WrongDirection,
+   Interrupted,
+   EmergencyStop,
+   SafetyTrip
+};
+
+/* The state of the controller at one tick of the control loop. */
+struct StatusSnapshot
+{
+   uint64_t tick;          // number of the control loop iteration
+   int64_t timestamp;      // nanoseconds since the epoch
+   degrees userAngle;
+   degrees cookedAngle;
+   degrees rawAngle;
+   float velocity;         // degrees per second
+   float duty;             // percent
+   SlewPhase phase;
+   MotorStatus motorStatus;
+   Fault fault;
+};
+
+// Format a snapshot as a line of JSON (including the final newline).
+// Returns the length of the line.
+int formatStatus(const StatusSnapshot& status, char* buffer, std::size_t size);
+
+
+/* Distribution of the controller status.
+ *
+ * The control loop calls publish() once per tick, which only stores the
+ * snapshot into a seqlock and costs the same no matter how many
+ * subscribers there are. A separate thread picks the snapshots up and sends
+ * them as JSON lines to the subscribers, every one at its own rate:
+ *
+ * - the standard output (if enabled with subscribeStdout()),
+ * - clients connecting to a Unix socket (if enabled with listen()). Clients
+ *   start at defaultRate and can change it by sending "rate <Hz>" lines;
+ *   "rate max" (or "rate 0") asks for every tick.
+ *
+ * A subscriber that can not keep up (a full socket buffer) misses snapshots
+ * instead of delaying anyone else.
+*/
+class StatusPublisher
+{
+public:
+   StatusPublisher() = default;
+   ~StatusPublisher();
+
+   // Send snapshots to the standard output at the given rate (0 means at
+   // every tick).
+   void subscribeStdout(float rate);
+
+   // Accept subscribers on a Unix socket. Returns false on failure (with
+   // errno set).
+   bool listen(const std::string& path);
+
+   // Keep the snapshots in the given seqlock instead of a private one (for
+   // example, one in shared memory). Must be called before start().
+   inline void publishTo(SeqLock<StatusSnapshot>& channel_) { channel = &channel_; }
+
+   // Start and stop the publishing thread. Before stopping, the latest
+   // snapshot is delivered to every subscriber that has not seen it yet.
+   void start();
+   void stop();
+
+   // Called by the control loop.
+   inline void publish(const StatusSnapshot& status) { channel->store(status); }
+
+   StatusSnapshot current() const { return channel->load(); }
+
+   static constexpr float defaultRate = 10;
+
+private:
+   struct Subscriber
+   {
+      int fd;
+      std::chrono::nanoseconds period;
+      std::chrono::steady_clock::time_point nextDue;
+      uint64_t lastTick;
+      std::string input;
+      std::string output;   // the rest of a line that did not fit the socket
+   };
+
+   void run();
+   void acceptClient();
+   bool readCommands(Subscriber& subscriber);
+   bool deliver(Subscriber& subscriber, const StatusSnapshot& status,
+                bool force);
+   static std::chrono::nanoseconds periodOf(float rate);
+
+   SeqLock<StatusSnapshot> latest;
+   SeqLock<StatusSnapshot>* channel = &latest;
+   std::vector<Subscriber> subscribers;
+   int listenFd = -1;
+   std::string socketPath;
+   std::thread thread;
+   std::atomic_bool stopRequested{false};
+};
+
+#endif // STATUS_H
@@ -0,0 +1,132 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "trace.h"
+
+namespace {
+
+struct TraceEvent
+{
+   const char* name;
+   std::chrono::steady_clock::time_point start;
+   std::chrono::steady_clock::duration duration;
+};
+
+struct TraceBuffer
+{
+   static const unsigned int capacity = 1 << 16;
+
+   const char* threadName;
+   long tid;
+   std::vector<TraceEvent> events;
+   uint64_t recorded = 0;
+};
+
+// All the buffers ever created; they are kept until the exit even if their
+// threads end.
+std::mutex registryMutex;
+std::vector<TraceBuffer*> registry;
+std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+thread_local TraceBuffer* threadBuffer = nullptr;
+
+void writeTrace()
+{
+   const char* filename = getenv("MCONTROL_TRACE");
+   if (!filename)
+      filename = "mcontrol-trace.json";
+
+   FILE* f = fopen(filename, "w");
+   if (!f)
+   {
+      perror(filename);
+      return;
+   }
+
+   std::lock_guard<std::mutex> lock(registryMutex);
+   long pid = getpid();
+   const char* separator = "";
+   fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+   for (TraceBuffer* buffer : registry)
+   {
+      fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,"
+                 "\"tid\":%ld,\"args\":{\"name\":\"%s\"}}",
+              separator, pid, buffer->tid, buffer->threadName);
+      separator = ",";
+
+      // Only the most recent events are still in the ring buffer.
+      uint64_t first = (buffer->recorded > TraceBuffer::capacity ?
+                        buffer->recorded - TraceBuffer::capacity : 0);
+      for (uint64_t i = first; i < buffer->recorded; i++)
+      {
+         const TraceEvent& e = buffer->events[i % TraceBuffer::capacity];
+         std::chrono::duration<double, std::micro> ts = e.start - epoch;
+         std::chrono::duration<double, std::micro> dur = e.duration;
+         fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%ld,\"tid\":%ld,"
+                    "\"ts\":%.3f,\"dur\":%.3f}",
+                 e.name, pid, buffer->tid, ts.count(), dur.count());
+      }
+   }
+   fprintf(f, "\n]}\n");
+   fclose(f);
+}
+
+TraceBuffer* currentBuffer(const char* name = "thread")
+{
+   if (!threadBuffer)
+   {
+      TraceBuffer* buffer = new TraceBuffer;
+      buffer->threadName = name;
+      buffer->tid = syscall(SYS_gettid);
+      buffer->events.resize(TraceBuffer::capacity);
+
+      std::lock_guard<std::mutex> lock(registryMutex);
+      if (registry.empty())
+         atexit(writeTrace);
+      registry.push_back(buffer);
+      threadBuffer = buffer;
+   }
+   return threadBuffer;
+}
+
+} // namespace
+
+
+TraceSpan::~TraceSpan()
+{
+   TraceBuffer* buffer = currentBuffer();
+   TraceEvent& e = buffer->events[buffer->recorded++ % TraceBuffer::capacity];
+   e.name = name;
+   e.start = start;
+   e.duration = std::chrono::steady_clock::now() - start;
+}
+
+
+void traceThread(const char* name)
+{
+   currentBuffer(name)->threadName = name;
+}
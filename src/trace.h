@@ -0,0 +1,71 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/* Tracing of individual control loop iterations.
+ *
+ * TRACE_SPAN("name") records the time from the point where it appears until
+ * the end of the enclosing scope. The spans are kept in a preallocated ring
+ * buffer of each thread (the most recent spans survive) and written out at
+ * the program exit as a Chrome trace-event JSON file, which can be opened in
+ * Perfetto (https://ui.perfetto.dev) or chrome://tracing. The file name is
+ * taken from the MCONTROL_TRACE environment variable and defaults to
+ * mcontrol-trace.json.
+ *
+ * TRACE_THREAD("name") names the current thread in the trace and allocates
+ * its buffer; threads that must not allocate later (e.g. in the control
+ * loop) should call it beforehand.
+ *
+ * Tracing is compiled in only with TRACING defined. Otherwise, the macros
+ * expand to nothing.
+*/
+#ifdef TRACING
+
+#include <chrono>
+
+class TraceSpan
+{
+public:
+   explicit TraceSpan(const char* name_) :
+      name(name_), start(std::chrono::steady_clock::now()) {}
+   ~TraceSpan();
+
+private:
+   const char* name;
+   std::chrono::steady_clock::time_point start;
+};
+
+void traceThread(const char* name);
+
+#define TRACE_CONCAT_(a, b) a ## b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SPAN(name) TraceSpan TRACE_CONCAT(traceSpan, __LINE__)(name)
+#define TRACE_THREAD(name) traceThread(name)
+
+#else
+
+#define TRACE_SPAN(name)
+#define TRACE_THREAD(name)
+
+#endif
+
+#endif // TRACE_H
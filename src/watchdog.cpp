@@ -0,0 +1,218 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <system_error>
+#include "eventloop.h"
+#include "output.h"
+#include "watchdog.h"
+
+constexpr std::chrono::milliseconds Watchdog::velocityWindow;
+
+
+PriorityInheritanceMutex::PriorityInheritanceMutex()
+{
+   pthread_mutexattr_t attributes;
+   pthread_mutexattr_init(&attributes);
+   // Without priority inheritance, this is just an ordinary mutex.
+   pthread_mutexattr_setprotocol(&attributes, PTHREAD_PRIO_INHERIT);
+   int error = pthread_mutex_init(&mutex, &attributes);
+   pthread_mutexattr_destroy(&attributes);
+   if (error)
+      throw std::system_error(error, std::generic_category(), "pthread_mutex_init");
+}
+
+
+PriorityInheritanceMutex::~PriorityInheritanceMutex()
+{
+   pthread_mutex_destroy(&mutex);
+}
+
+
+void PriorityInheritanceMutex::lock()
+{
+   int error = pthread_mutex_lock(&mutex);
+   if (error)
+      throw std::system_error(error, std::generic_category(), "pthread_mutex_lock");
+}
+
+
+bool PriorityInheritanceMutex::try_lock()
+{
+   return pthread_mutex_trylock(&mutex) == 0;
+}
+
+
+void PriorityInheritanceMutex::unlock()
+{
+   pthread_mutex_unlock(&mutex);
+}
+
+
+Watchdog::Watchdog(Motor& motor_, Sensor& sensor_, const WatchdogParams& params_) :
+   motor(motor_), sensor(sensor_), params(params_)
+{
+   newParams.store(params_);
+}
+
+
+Watchdog::~Watchdog()
+{
+   if (thread.joinable())
+   {
+      stopRequested = true;
+      thread.join();
+   }
+}
+
+
+void Watchdog::setParams(const WatchdogParams& params_)
+{
+   newParams.store(params_);
+}
+
+
+void Watchdog::arm(float direction_)
+{
+   if (!newParams.load().enabled)
+      return;
+
+   haveReference = false;
+   direction = direction_;
+   heartbeat();
+   armed = true;
+   if (!thread.joinable())
+      thread = std::thread(&Watchdog::run, this);
+}
+
+
+void Watchdog::disarm()
+{
+   armed = false;
+}
+
+
+void Watchdog::reset()
+{
+   std::lock_guard<PriorityInheritanceMutex> lock(mutex);
+   trip = Trip::None;
+}
+
+
+const char* Watchdog::describe(Trip reason)
+{
+   switch (reason)
+   {
+      case Trip::None: return "none";
+      case Trip::Limit: return "safe limit exceeded";
+      case Trip::Velocity: return "maximum velocity exceeded";
+      case Trip::Heartbeat: return "control loop not responding";
+   }
+   return "unknown";
+}
+
+
+void Watchdog::run()
+{
+   blockSignalsInThread();
+
+   // Get ahead of the control loop (which runs at the normal priority).
+   sched_param sched;
+   sched.sched_priority = params.priority;
+   int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sched);
+   if (error)
+      asyncOutput().message(stderr,
+         "warning: watchdog: could not set real-time priority: %s\n",
+         strerror(error));
+
+   auto next = std::chrono::steady_clock::now();
+   while (!stopRequested)
+   {
+      params = newParams.load();
+      next += params.period;
+      std::this_thread::sleep_until(next);
+      if (armed && !tripped())
+         check();
+   }
+}
+
+
+void Watchdog::check()
+{
+   auto now = std::chrono::steady_clock::now();
+   if (now - std::chrono::steady_clock::time_point(
+             std::chrono::steady_clock::duration(lastHeartbeat)) > params.heartbeatTimeout)
+   {
+      cut(Trip::Heartbeat);
+      return;
+   }
+
+   // The median of three readouts, in case of a spike.
+   degrees readouts[3];
+   {
+      std::lock_guard<PriorityInheritanceMutex> lock(mutex);
+      for (auto& readout : readouts)
+         readout = CookedAngle(sensor.getRawCode()).val;
+   }
+   std::sort(readouts, readouts + 3);
+   CookedAngle angle(readouts[1]);
+
+   if ((direction > 0 && angle > CookedAngle::getMaximum() + params.limitMargin) ||
+       (direction < 0 && angle < CookedAngle::getMinimum() - params.limitMargin))
+   {
+      cut(Trip::Limit);
+      return;
+   }
+
+   if (!haveReference)
+   {
+      referenceAngle = angle;
+      referenceTime = now;
+      haveReference = true;
+   }
+   else if (now - referenceTime >= velocityWindow)
+   {
+      float elapsed = std::chrono::duration<float>(now - referenceTime).count();
+      if (std::abs(angle - referenceAngle) / elapsed > params.maxVelocity)
+      {
+         cut(Trip::Velocity);
+         return;
+      }
+      referenceAngle = angle;
+      referenceTime = now;
+   }
+}
+
+
+void Watchdog::cut(Trip reason)
+{
+   {
+      std::lock_guard<PriorityInheritanceMutex> lock(mutex);
+      trip = reason;
+      motor.setPWM(0);
+      motor.turnOff();
+   }
+   asyncOutput().message(stderr, "\nWatchdog tripped: %s!\n", describe(reason));
+}
@@ -0,0 +1,145 @@
+/*
+ *    mcontrol, declination axis control for PAART, the radiotelescope of
+ *              Astronomical Society Vega - Ljubljana
+ *
+ *    Copyright (C) 2014 Andrej Lajovic <andrej.lajovic@ad-vega.si>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <pthread.h>
+#include <thread>
+#include "angles.h"
+#include "interface.h"
+#include "seqlock.h"
+
+struct WatchdogParams
+{
+   bool enabled = false;
+   std::chrono::milliseconds period{20};
+   std::chrono::milliseconds heartbeatTimeout{500};
+   float maxVelocity = 10;       // degrees per second
+   degrees limitMargin = 1;
+   int priority = 50;
+};
+
+
+/* A mutex with priority inheritance (where the system supports it): a
+ * thread holding it runs at the priority of the highest one waiting for it.
+ * Otherwise the real-time watchdog could wait for the control loop to
+ * finish a sensor readout while the control loop itself waits for the CPU.
+ * Usable with std::lock_guard and std::unique_lock.
+*/
+class PriorityInheritanceMutex
+{
+public:
+   PriorityInheritanceMutex();
+   ~PriorityInheritanceMutex();
+
+   PriorityInheritanceMutex(const PriorityInheritanceMutex&) = delete;
+   PriorityInheritanceMutex& operator=(const PriorityInheritanceMutex&) = delete;
+
+   void lock();
+   bool try_lock();
+   void unlock();
+
+private:
+   pthread_mutex_t mutex;
+};
+
+
+/* The safety watchdog.
+ *
+ * An independent thread (at a real-time priority, if the system permits)
+ * that watches over the slews. While armed, it reads the sensor on its own
+ * and trips if
+ *
+ * - the axis goes more than limitMargin past the safe limits (in the
+ *   direction of the slew; an axis that starts outside of the limits can
+ *   still be brought back),
+ * - the axis turns faster than maxVelocity, or
+ * - the control loop has not sent a heartbeat for heartbeatTimeout.
+ *
+ * A trip cuts the motor power and opens both relays right away. The trip is
+ * latched: the motor can not be turned on again through the controller
+ * until reset() is called.
+ *
+ * The watchdog and the controller share the motor and the sensor. All
+ * accesses to them must be made with hardwareMutex() held.
+*/
+class Watchdog
+{
+public:
+   enum class Trip : uint8_t { None, Limit, Velocity, Heartbeat };
+
+   Watchdog(Motor& motor_, Sensor& sensor_, const WatchdogParams& params_);
+   ~Watchdog();
+
+   // Replace the parameters (only while disarmed). The watchdog thread
+   // picks them up at its next period.
+   void setParams(const WatchdogParams& params_);
+
+   // Start and stop watching a slew in the given direction. The thread is
+   // started on the first arm().
+   void arm(float direction);
+   void disarm();
+
+   inline void heartbeat()
+      { lastHeartbeat = std::chrono::steady_clock::now().time_since_epoch().count(); }
+
+   inline bool tripped() const { return trip != Trip::None; }
+   inline Trip reason() const { return trip; }
+   void reset();
+
+   inline PriorityInheritanceMutex& hardwareMutex() { return mutex; }
+
+   static const char* describe(Trip reason);
+
+private:
+   void run();
+   void check();
+   void cut(Trip reason);
+
+   Motor& motor;
+   Sensor& sensor;
+
+   // The parameters as set by setParams(), and the copy of them that the
+   // watchdog thread works with.
+   SeqLock<WatchdogParams> newParams;
+   WatchdogParams params;
+
+   PriorityInheritanceMutex mutex;
+   std::thread thread;
+   std::atomic_bool stopRequested{false};
+   std::atomic_bool armed{false};
+   std::atomic<float> direction{0};
+   std::atomic<std::chrono::steady_clock::rep> lastHeartbeat{0};
+   std::atomic<Trip> trip{Trip::None};
+
+   // Velocity is measured over at least this long, so that the sensor noise
+   // does not trip the watchdog.
+   static constexpr std::chrono::milliseconds velocityWindow{200};
+   std::atomic_bool haveReference{false};
+   CookedAngle referenceAngle{0};
+   std::chrono::steady_clock::time_point referenceTime;
+};
+
+#endif // WATCHDOG_H